@@ -0,0 +1,480 @@
+#include "events.h"
+#include "waveform.h"
+#include "pio.h"
+#include "garaged_impl.h"
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <cstdlib>
+#ifdef BENCH_WIRINGPI
+#  include <wiringPi.h>
+#endif
+#ifdef EVENTS_EPOLL
+#  include <unistd.h>
+#  include <fcntl.h>
+#endif
+using namespace std;
+
+// EventQueue micro-benchmarks; build with `make bench`, no wiringPi needed.
+// Every result is one line of space-separated key=value pairs starting with
+// bench=<name>, so runs against different queue backends can be diffed or
+// loaded as they are. Latencies are per call in nanoseconds.
+
+static const int DepthRounds = 20000;
+static const int Depths[] = { 1, 10, 100, 1000, 10000, 100000 };
+static const int ProducerCounts[] = { 1, 2, 4, 8 };
+static const chrono::milliseconds ProducerRunTime(500);
+static const size_t ProducerSamples = 1 << 18;
+static const int ToggleRounds = 100000;
+static const int LineEventRounds = 20000;
+static const int LineEventBurst = 8;
+
+static double ToNs(Duration duration)
+{
+    return chrono::duration<double, nano>(duration).count();
+}
+
+static double Percentile(vector<double>& samples, double quantile)
+{
+    if (samples.empty())
+        return 0;
+    size_t index = min(samples.size() - 1, size_t(quantile * double(samples.size())));
+    nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
+// Latencies come from `samples`, throughput from `ops` (which may be more).
+static void Report(const string& bench, const string& params, vector<double>& samples, uint64_t ops, double seconds)
+{
+    cout << "bench=" << bench << ' ' << params
+         << " ops=" << ops
+         << " ops_per_sec=" << (seconds > 0 ? double(ops) / seconds : 0)
+         << " p50_ns=" << Percentile(samples, 0.5)
+         << " p99_ns=" << Percentile(samples, 0.99)
+         << " max_ns=" << Percentile(samples, 1.0) << endl;
+}
+
+// Times `op` once per round and reports latency percentiles and throughput.
+template<typename F>
+static void Measure(const string& bench, const string& params, int rounds, F op)
+{
+    vector<double> samples;
+    samples.reserve(rounds);
+    Time begin = Clock::now();
+    for (int i = 0; i < rounds; ++i)
+    {
+        Time start = Clock::now();
+        op(i);
+        samples.push_back(ToNs(Clock::now() - start));
+    }
+    double seconds = chrono::duration<double>(Clock::now() - begin).count();
+    Report(bench, params, samples, samples.size(), seconds);
+}
+
+// A queue holding `depth` unrelated far-future timers, mixed like Garaged's.
+static void Fill(EventQueue& q, int depth)
+{
+    Time far = Clock::now() + chrono::hours(1);
+    for (int i = 0; i < depth; ++i)
+    {
+        EventType type = (i % 2) ? ET_Blink : ET_BlinkExternal;
+        q.PlanEvent(Event(type, 0, uint8_t(i % EventQueueBase::MaxTargets)), far + chrono::milliseconds(i));
+    }
+}
+
+static void BenchDepth(int depth)
+{
+    string params = "depth=" + to_string(depth);
+    EventQueue q(depth + 64);
+    Fill(q, depth);
+
+    Measure("plan_replan", params, DepthRounds, [&](int)
+    {
+        q.PlanEvent(ET_Input0, chrono::milliseconds(100), true);
+    });
+    Measure("plan_cancel", params, DepthRounds, [&](int)
+    {
+        q.Cancel(q.PlanEvent(ET_Halt, chrono::seconds(7)));
+    });
+    Measure("plan_delete_events", params, DepthRounds, [&](int)
+    {
+        q.PlanEvent(ET_Halt, chrono::seconds(7));
+        q.DeleteEvents(ET_Halt);
+    });
+    EventHandle tooLong = q.PlanEvent(ET_LightTooLong, chrono::minutes(25));
+    Measure("reschedule", params, DepthRounds, [&](int i)
+    {
+        q.Reschedule(tooLong, chrono::minutes(25) + chrono::milliseconds(i));
+    });
+    q.Cancel(tooLong);
+    q.DeleteEvents(ET_Input0);
+
+    // One due event on top of the far timers; dispatching it is the wait.
+    Measure("wait_event", params, DepthRounds, [&](int i)
+    {
+        q.PlanEvent(Event(ET_Input1, uint32_t(i)));
+        q.WaitEvent();
+    });
+    Measure("post_wait_event", params, DepthRounds, [&](int i)
+    {
+        q.PostEvent(Event(ET_Input1, uint32_t(i)), Duration());
+        q.WaitEvent();
+    });
+}
+
+// Consumer running Garaged::Exec's blink-heavy mix on a compressed time
+// scale, while `producers` threads replan their own input events with
+// deletePrevious the way the ISRs do, through PostEvent or PlanEvent.
+static void BenchProducers(int producers, bool post)
+{
+    const Duration none = Duration();
+    EventQueue q(EventQueue::DefaultCapacity);
+    atomic<bool> running{true};
+    atomic<uint64_t> dispatched{0};
+
+    thread consumer([&]
+    {
+        Waveform blink, display;
+        blink.Then(true, chrono::microseconds(50), chrono::microseconds(10))
+             .Then(false, chrono::microseconds(150), chrono::microseconds(10))
+             .Repeat(Waveform::Forever);
+        display.Then(true, chrono::microseconds(7), chrono::microseconds(2))
+               .Then(false, chrono::microseconds(25), chrono::microseconds(2))
+               .Repeat(4)
+               .Then(true, chrono::microseconds(7), chrono::microseconds(2))
+               .Then(false, chrono::microseconds(270), chrono::microseconds(20));
+        q.PlanWaveform(ET_Blink, none, blink);
+        q.PlanWaveform(ET_BlinkExternal, none, display);
+        Event batch[8];
+        for (;;)
+        {
+            size_t count = q.WaitEvents(batch, 8);
+            for (size_t i = 0; i < count; ++i)
+            {
+                Event evt = batch[i];
+                if (evt.Type() == ET_Halt)
+                    return;
+                if (evt.Type() == ET_BlinkExternal && (evt.Data() & WaveEnd))
+                    q.PlanWaveform(ET_BlinkExternal, none, display);
+            }
+            dispatched.fetch_add(count, memory_order_relaxed);
+        }
+    });
+
+    vector<vector<double>> samples(producers);
+    atomic<uint64_t> ops{0};
+    vector<thread> threads;
+    Time begin = Clock::now();
+    for (int p = 0; p < producers; ++p)
+    {
+        samples[p].reserve(ProducerSamples);
+        threads.emplace_back([&, p]
+        {
+            Event event((p % 2) ? ET_Input1 : ET_Input0, 0, uint8_t(p % EventQueueBase::MaxTargets));
+            uint64_t count = 0;
+            for (; running.load(memory_order_relaxed); ++count)
+            {
+                Time start = Clock::now();
+                if (post)
+                    q.PostEvent(event, chrono::milliseconds(100));
+                else
+                    q.PlanEvent(event, chrono::milliseconds(100), true);
+                if (samples[p].size() < ProducerSamples)
+                    samples[p].push_back(ToNs(Clock::now() - start));
+            }
+            ops += count;
+        });
+    }
+    this_thread::sleep_for(ProducerRunTime);
+    running = false;
+    for (thread& t : threads)
+        t.join();
+    double seconds = chrono::duration<double>(Clock::now() - begin).count();
+    q.PlanEvent(ET_Halt);
+    consumer.join();
+
+    vector<double> all;
+    for (vector<double>& s : samples)
+        all.insert(all.end(), s.begin(), s.end());
+    string params = string("producers=") + to_string(producers) + " consumer_events_per_sec=" + to_string(uint64_t(double(dispatched) / seconds));
+    Report(post ? "producers_post" : "producers_plan", params, all, ops, seconds);
+}
+
+// Replays Garaged's light-on timer traffic (heartbeat blink plus the time-left
+// display waveforms) in real time and extrapolates wakeups per hour.
+static void BenchWakeups(bool slack, chrono::seconds length)
+{
+    const Duration none = Duration();
+    Duration blinkSlack = slack ? chrono::milliseconds(100) : none;
+    Duration trainSlack = slack ? chrono::milliseconds(20) : none;
+    Waveform blink, display;
+    blink.Then(true, chrono::milliseconds(500), blinkSlack)
+         .Then(false, chrono::milliseconds(1500), blinkSlack)
+         .Repeat(Waveform::Forever);
+    display.Then(true, chrono::milliseconds(70), trainSlack)
+           .Then(false, chrono::milliseconds(250), trainSlack)
+           .Repeat(2)
+           .Then(true, chrono::milliseconds(70), trainSlack)
+           .Then(false, chrono::milliseconds(2700), slack ? chrono::milliseconds(200) : none);
+    EventQueue q;
+    Time start = Clock::now();
+    q.PlanWaveform(ET_Blink, none, blink);
+    q.PlanWaveform(ET_BlinkExternal, none, display);
+    q.PlanEvent(ET_Halt, start + length);
+    Event batch[8];
+    for (bool running = true; running;)
+    {
+        size_t count = q.WaitEvents(batch, 8);
+        for (size_t i = 0; i < count; ++i)
+        {
+            Event evt = batch[i];
+            if (evt.Type() == ET_BlinkExternal && (evt.Data() & WaveEnd))
+            {
+                q.PlanWaveform(ET_BlinkExternal, none, display);
+            }
+            else if (evt.Type() == ET_Halt)
+            {
+                running = false;
+            }
+        }
+    }
+    double hours = chrono::duration<double, ratio<3600>>(Clock::now() - start).count();
+    EventQueue::Stats stats = q.GetStats();
+    cout << "bench=wakeups slack=" << slack << " wakeups_per_hour=" << stats.wakeups / hours
+         << " coalesced_per_hour=" << stats.coalesced / hours << endl;
+}
+
+// Output toggles through PioGpio: one pin, and three pins of a port in one
+// batch the way ControlLight writes them.
+static void BenchPio(PioGpio& pio, const string& params, int gpio)
+{
+    Measure("gpio_toggle", params + " pins=1", ToggleRounds, [&](int i)
+    {
+        pio.Write(gpio, i & 1);
+    });
+    Measure("gpio_toggle", params + " pins=3", ToggleRounds, [&](int i)
+    {
+        PioGpio::Batch batch;
+        batch.Set(gpio, i & 1);
+        batch.Set(gpio ^ 1, i & 1);
+        batch.Set(gpio ^ 2, !(i & 1));
+        pio.Write(batch);
+    });
+}
+
+// Off the board the registers are a plain buffer. With --toggle-pin N on
+// the board (as root, built with -DBENCH_WIRINGPI) wiringPi pin N is also
+// toggled through digitalWrite and through the mapped registers, so the two
+// paths can be compared; pins=3 then also flips two neighbours of N.
+static void BenchToggle(int wiringPin)
+{
+    static volatile uint32_t fakeRegisters[PioGpio::Ports * PioGpio::PortWords];
+    PioGpio fake;
+    fake.Attach(fakeRegisters);
+    BenchPio(fake, "backend=pio_fake", 6);
+#   ifdef BENCH_WIRINGPI
+    if (wiringPin < 0)
+        return;
+    wiringPiSetup();
+    pinMode(wiringPin, OUTPUT);
+    Measure("gpio_toggle", "backend=wiringpi pins=1", ToggleRounds, [&](int i)
+    {
+        digitalWrite(wiringPin, i & 1);
+    });
+    PioGpio pio;
+    if (pio.Open() && PioGpio::Covers(wpiPinToGpio(wiringPin)))
+        BenchPio(pio, "backend=pio_mmap", wpiPinToGpio(wiringPin));
+    else
+        cout << "bench=gpio_toggle backend=pio_mmap unavailable" << endl;
+    digitalWrite(wiringPin, LOW);
+#   else
+    (void)wiringPin;
+#   endif
+}
+
+#ifdef EVENTS_LINE_EVENTS
+// A pipe scripted with gpio_v2_line_event records stands in for a GPIO line
+// request: each round writes one bouncing burst and waits for the input
+// event it settles into, then checks its time and level came from the
+// records. Latency is from the write to the dispatch.
+static bool BenchLineEvents()
+{
+    int fds[2];
+    if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) != 0)
+        return false;
+    EventQueue q;
+    Debouncer debouncer;
+    q.WatchEdges(fds[0], ET_Input0, debouncer, EventQueueBase::EF_LineEvents);
+    bool exact = true;
+    Measure("line_events", "burst=" + to_string(LineEventBurst), LineEventRounds, [&](int i)
+    {
+        gpio_v2_line_event records[LineEventBurst] = {};
+        Time first = Clock::now() - chrono::milliseconds(1);
+        for (int r = 0; r < LineEventBurst; ++r)
+        {
+            records[r].timestamp_ns = chrono::duration_cast<chrono::nanoseconds>((first + chrono::microseconds(r)).time_since_epoch()).count();
+            records[r].id = ((r + i) % 2) ? GPIO_V2_LINE_EVENT_FALLING_EDGE : GPIO_V2_LINE_EVENT_RISING_EDGE;
+        }
+        (void)!write(fds[1], records, sizeof(records));
+        Time again;
+        q.WaitEvent();
+        exact &= debouncer.Settle(Clock::now(), again) &&
+                 chrono::duration_cast<chrono::microseconds>(debouncer.SettledTime() - first).count() == 0 &&
+                 debouncer.SettledLevel() == int((LineEventBurst - 1 + i) % 2 == 0);
+    });
+    close(fds[1]);
+    cout << "bench=line_events exact=" << exact << " bursts=" << debouncer.Bursts() << " edges=" << debouncer.Edges() << endl;
+    return exact;
+}
+#endif
+
+// Plan, post, delete and dispatch in a loop once the queue is warmed up; the
+// pooled queue must not touch the heap at all.
+static bool CheckSteadyStateAllocations()
+{
+    EventQueue q;
+    q.PlanEvent(ET_WriteStats, chrono::hours(4));
+    Waveform wave;
+    wave.Then(true, chrono::milliseconds(70)).Then(false, chrono::milliseconds(250)).Repeat(10);
+    auto cycle = [&q, &wave]
+    {
+        q.PlanEvent(Event(ET_Blink, 1), Time(), true);
+        q.Cancel(q.PlanPeriodic(Event(ET_BlinkExternal, 1), Time(), chrono::milliseconds(300), chrono::milliseconds(300)));
+        q.Cancel(q.PlanWaveform(ET_BlinkExternal, Time(), wave));
+        q.PostEvent(ET_Input0, Duration(0));
+        q.PlanEvent(ET_Halt, chrono::seconds(7));
+        q.DeleteEvents(ET_Halt);
+        q.WaitEvent();
+        q.WaitEvent();
+    };
+    cycle();
+    uint64_t before = AllocationCount();
+    for (int i = 0; i < 10000; ++i)
+    {
+        cycle();
+    }
+    uint64_t allocations = AllocationCount() - before;
+    cout << "bench=steady_state allocations=" << allocations << endl;
+    return allocations == 0;
+}
+
+// The board for CheckDoorAllocations: the button is held during DoorPresses
+// and outputs go nowhere. The count is taken as the host's Init starts.
+struct DoorPress
+{
+    Duration at;
+    Duration length;
+};
+
+static const DoorPress DoorPresses[] =
+{
+    { chrono::seconds(1), chrono::milliseconds(300) },      // on, then too long, almost off and off
+    { chrono::minutes(30), chrono::milliseconds(300) },     // on
+    { chrono::minutes(31), chrono::milliseconds(300) },     // off
+};
+
+static Time gDoorStart;
+static uint64_t gInitAllocations;
+
+struct BenchHal
+{
+    using ClockPolicy = VirtualClock;
+
+    static const char* Setup()
+    {
+        gInitAllocations = AllocationCount();
+        return "bench";
+    }
+
+    static void SetOutput(int, int) {}
+    static void SetInput(int) {}
+    static void Write(const PinLevel*, size_t) {}
+
+    static int Read(int pin)
+    {
+        Duration now = VirtualClock::Now() - gDoorStart;
+        for (const DoorPress& press : DoorPresses)
+        {
+            if (pin == PN_Button && now >= press.at && now < press.at + press.length)
+                return PinLow;
+        }
+        return PinHigh;
+    }
+
+    static void OnEdges(int, void (*)()) {}
+#   ifdef EVENTS_EPOLL
+    static int OpenEdges(int, EventQueueBase::EdgeFormat&) { return -1; }
+#   endif
+    static int Reboot() { return 0; }
+
+    static bool ReadSysInfo(SysInfo& info)
+    {
+        info = {};
+        return true;
+    }
+};
+
+// A door from Init through two light on/off cycles, one ending with the too
+// long timeout and one with the button, to the halt that ends Exec: none of
+// it may touch the heap.
+static bool CheckDoorAllocations()
+{
+    using Host = BasicGaragedHost<BenchHal>;
+    gDoorStart = Time(chrono::hours(24));
+    VirtualClock::Set(gDoorStart);
+    Host& host = Host::Instance();
+    host.SetLogFileName("/dev/null");
+    Host::Door* door = host.AddDoor(DefaultConfig);
+    const InputConfig& button = door->Config().inputs[0];
+    for (const DoorPress& press : DoorPresses)
+    {
+        host.Q().PlanEvent(door->InputEvent(0), gDoorStart + press.at + button.debounce);
+        host.Q().PlanEvent(door->InputEvent(0), gDoorStart + press.at + press.length + button.debounce);
+    }
+    host.Q().PlanEvent(door->MakeEvent(ET_Halt), gDoorStart + chrono::minutes(32));
+    host.Exec();
+    uint64_t allocations = AllocationCount() - gInitAllocations;
+    cout << "bench=door_steady_state allocations=" << allocations
+         << " dispatched=" << host.Q().GetStats().dispatched << endl;
+    return allocations == 0;
+}
+
+int main(int argc, char** argv)
+{
+    // --quick skips the real-time wakeup replay, which takes 20 seconds.
+    bool quick = false;
+    int togglePin = -1;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (string(argv[i]) == "--quick")
+            quick = true;
+        else if (string(argv[i]) == "--toggle-pin" && i + 1 < argc)
+            togglePin = atoi(argv[++i]);
+    }
+    for (int depth : Depths)
+    {
+        BenchDepth(depth);
+    }
+    for (int producers : ProducerCounts)
+    {
+        BenchProducers(producers, true);
+        BenchProducers(producers, false);
+    }
+    BenchToggle(togglePin);
+#   ifdef EVENTS_LINE_EVENTS
+    bool lineEventsExact = BenchLineEvents();
+#   else
+    bool lineEventsExact = true;
+#   endif
+    if (!quick)
+    {
+        BenchWakeups(false, chrono::seconds(10));
+        BenchWakeups(true, chrono::seconds(10));
+    }
+    bool steadyState = CheckSteadyStateAllocations();
+    bool doorSteadyState = CheckDoorAllocations();
+    return (steadyState && doorSteadyState && lineEventsExact) ? 0 : 1;
+}
@@ -0,0 +1,217 @@
+#ifndef GUARD_BOARD_H
+#define GUARD_BOARD_H
+#include "hal.h"
+#include "pio.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/sysinfo.h>
+#include <wiringPi.h>
+#ifdef EVENTS_EPOLL
+#  include <sys/ioctl.h>
+#endif
+
+const Duration KernelDebounce = std::chrono::milliseconds(1);   // chatter the GPIO driver may swallow
+
+// The Orange Pi through wiringPi (WiringOtherPi); see hal.h.
+struct WiringPiHal
+{
+    using ClockPolicy = SystemClock;
+
+    static const char* Setup()
+    {
+        wiringPiSetup();
+        return "wiringPi";
+    }
+
+    static void SetOutput(int pin, int level)
+    {
+        pinMode(pin, OUTPUT);
+        digitalWrite(pin, level);
+    }
+
+    static void SetInput(int pin)
+    {
+        pinMode(pin, INPUT);
+        pullUpDnControl(pin, PUD_OFF);
+    }
+
+    static void Write(const PinLevel* levels, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            if (levels[i].pin >= 0)
+                digitalWrite(levels[i].pin, levels[i].value);
+        }
+    }
+
+    static int Read(int pin) { return digitalRead(pin); }
+
+    static void OnEdges(int pin, void (*isr)()) { wiringPiISR(pin, INT_EDGE_BOTH, isr); }
+
+#   ifdef EVENTS_EPOLL
+    // The GPIO character device if the kernel and its headers have it, else
+    // the sysfs value file that wiringPiISR would have polled.
+    static int OpenEdges(int pin, EventQueueBase::EdgeFormat& format)
+    {
+#       ifdef EVENTS_LINE_EVENTS
+        int fd = OpenLineEventFd(pin);
+        format = EventQueueBase::EF_LineEvents;
+        if (fd != -1)
+            return fd;
+#       endif
+        format = EventQueueBase::EF_SysfsValue;
+        return OpenSysfsEdgeFd(pin);
+    }
+#   endif
+
+    static int Reboot() { return system("reboot"); }
+
+    static bool ReadSysInfo(SysInfo& info)
+    {
+        struct sysinfo si;
+        if (sysinfo(&si) != 0)
+            return false;
+        info = { si.uptime, { si.loads[0], si.loads[1], si.loads[2] },
+                 si.totalram, si.freeram, si.sharedram, si.bufferram, si.procs };
+        return true;
+    }
+
+#   ifdef EVENTS_EPOLL
+private:
+    static bool WriteSysfs(const char* path, const char* value)
+    {
+        int fd = open(path, O_WRONLY | O_CLOEXEC);
+        if (fd == -1)
+            return false;
+        ssize_t len = ssize_t(strlen(value));
+        bool ok = (write(fd, value, len) == len);
+        close(fd);
+        return ok;
+    }
+
+    // Does what wiringPiISR does internally: exports the pin, enables
+    // interrupts on both edges and returns its value descriptor.
+    static int OpenSysfsEdgeFd(int pin)
+    {
+        char path[64];
+        char number[16];
+        int gpio = wpiPinToGpio(pin);
+        snprintf(number, sizeof(number), "%d", gpio);
+        WriteSysfs("/sys/class/gpio/export", number);
+        snprintf(path, sizeof(path), "/sys/class/gpio/gpio%d/edge", gpio);
+        if (!WriteSysfs(path, "both"))
+            return -1;
+        snprintf(path, sizeof(path), "/sys/class/gpio/gpio%d/value", gpio);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd != -1)
+        {
+            char value[8];
+            (void)!read(fd, value, sizeof(value));
+        }
+        return fd;
+    }
+
+#   ifdef EVENTS_LINE_EVENTS
+    // Requests `pin` from the GPIO character device with both edges
+    // reported, debounced in the kernel by KernelDebounce where the driver
+    // can, and returns the non-blocking request descriptor; -1 on kernels
+    // without the v2 uAPI. On the H3, gpiochip0 is the main PIO (PA0 = 0)
+    // and gpiochip1 the R_PIO, whose PL0 is GPIO 352.
+    static int OpenLineEventFd(int pin)
+    {
+        int gpio = wpiPinToGpio(pin);
+        if (gpio < 0)
+            return -1;
+        const char* chip = (gpio >= 352) ? "/dev/gpiochip1" : "/dev/gpiochip0";
+        int chipFd = open(chip, O_RDONLY | O_CLOEXEC);
+        if (chipFd == -1)
+            return -1;
+        gpio_v2_line_request request = {};
+        request.offsets[0] = (gpio >= 352) ? gpio - 352 : gpio;
+        request.num_lines = 1;
+        snprintf(request.consumer, sizeof(request.consumer), "garaged");
+        request.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+        request.config.num_attrs = 1;
+        request.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_DEBOUNCE;
+        request.config.attrs[0].attr.debounce_period_us =
+            std::uint32_t(std::chrono::duration_cast<std::chrono::microseconds>(KernelDebounce).count());
+        request.config.attrs[0].mask = 1;
+        bool ok = (ioctl(chipFd, GPIO_V2_GET_LINE_IOCTL, &request) == 0);
+        if (!ok)
+        {
+            request.config.num_attrs = 0;
+            ok = (ioctl(chipFd, GPIO_V2_GET_LINE_IOCTL, &request) == 0);
+        }
+        close(chipFd);
+        if (!ok)
+            return -1;
+        fcntl(request.fd, F_SETFL, fcntl(request.fd, F_GETFL) | O_NONBLOCK);
+        return request.fd;
+    }
+#   endif
+#   endif
+};
+
+// WiringPiHal with pin writes and reads going straight to the H3 PIO data
+// registers, several pins of a port in one store. Pins the registers do not
+// cover, or all of them if the block cannot be mapped, stay with wiringPi.
+struct PioHal : WiringPiHal
+{
+    static const int MaxPins = 64;
+
+    static const char* Setup()
+    {
+        WiringPiHal::Setup();
+        if (!Registers().Open())
+            return "wiringPi, unable to map the PIO registers";
+        for (int pin = 0; pin < MaxPins; ++pin)
+            GpioOfPin()[pin] = wpiPinToGpio(pin);
+        return "H3 PIO registers";
+    }
+
+    static void Write(const PinLevel* levels, std::size_t count)
+    {
+        if (!Registers().IsOpen())
+            return WiringPiHal::Write(levels, count);
+        PioGpio::Batch batch;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            int gpio = Gpio(levels[i].pin);
+            if (PioGpio::Covers(gpio))
+                batch.Set(gpio, levels[i].value);
+            else
+                WiringPiHal::Write(&levels[i], 1);
+        }
+        Registers().Write(batch);
+    }
+
+    static int Read(int pin)
+    {
+        int gpio = Gpio(pin);
+        return PioGpio::Covers(gpio) ? Registers().Read(gpio) : digitalRead(pin);
+    }
+
+private:
+    static PioGpio& Registers()
+    {
+        static PioGpio registers;
+        return registers;
+    }
+
+    static int* GpioOfPin()
+    {
+        static int gpioOfPin[MaxPins];
+        return gpioOfPin;
+    }
+
+    // -1 (not covered) unless the registers are mapped.
+    static int Gpio(int pin)
+    {
+        return (Registers().IsOpen() && pin >= 0 && pin < MaxPins) ? GpioOfPin()[pin] : -1;
+    }
+};
+
+#endif//GUARD
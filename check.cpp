@@ -0,0 +1,139 @@
+#include "config.h"
+#include "waveform.h"
+#include <iostream>
+#include <sstream>
+#include <string>
+using namespace std;
+
+// Correctness checks that need no hardware; `make check` builds and runs
+// them. Every check prints one line, check=<name> ok=0|1 and what it saw,
+// and the exit status is the number of failed checks.
+
+static int gFailed = 0;
+
+static void Report(const string& check, bool ok, const string& details = string())
+{
+    cout << "check=" << check << " ok=" << ok;
+    if (!details.empty())
+        cout << ' ' << details;
+    cout << endl;
+    if (!ok)
+        ++gFailed;
+}
+
+static bool Parses(const string& text)
+{
+    istringstream in(text);
+    HostConfig config;
+    string error;
+    return ParseConfig(in, config, error);
+}
+
+// Settings that would stop the controller must fail to parse, so that a
+// reload with them is logged and ignored.
+static void CheckConfigRejects()
+{
+    static const char* const Rejected[] =
+    {
+        "blink_on_time_ms = 0",
+        "blink_off_time_ms = 0",
+        "light_timeout_blink_ms = 0",
+        "display_time_left_period_ms = 0",
+        "light_too_long_timeout_ms = -5",
+        "light_too_long_timeout_ms = 86400001",
+        "input0_debounce_ms = 9223372036854775807",
+        "relay_pin = none",
+        "input0_pin = none",
+        "external_led_pin = 6",
+        "input2_pin = 30",
+        "[left]\n[right]",
+    };
+    static const char* const Accepted[] =
+    {
+        "input0_debounce_ms = 0",
+        "input1_pin = none",
+        "external_led_pin = none",
+        "blink_on_time_ms = 1",
+        "light_too_long_timeout_ms = 86400000",
+        "external_led_pin = none\ninput2_pin = 24",
+        "[left]\n[right]\nrelay_pin = 7\ninternal_led_pin = 8\nexternal_led_pin = none\ninput0_pin = 9\ninput1_pin = none",
+    };
+    string wrong;
+    for (const char* line : Rejected)
+    {
+        if (Parses(line))
+            wrong += string(" accepted=<") + line + '>';
+    }
+    for (const char* line : Accepted)
+    {
+        if (!Parses(line))
+            wrong += string(" rejected=<") + line + '>';
+    }
+    Report("config_rejects", wrong.empty(), wrong.substr(wrong.empty() ? 0 : 1));
+}
+
+// A forever waveform, like the heartbeat, that stalls for an hour delivers at
+// most one overdue step and carries on in phase, rather than replaying the
+// missed ones back to back.
+static void CheckWaveformStall()
+{
+    using Queue = BasicEventQueue<VirtualClock>;
+    const Duration on = chrono::milliseconds(500);
+    const Duration off = chrono::milliseconds(1500);
+    Time start = Time(chrono::hours(24));
+    VirtualClock::Set(start);
+    Queue q(16);
+    Waveform wave = Waveform().Then(true, on).Then(false, off).Repeat(Waveform::Forever);
+    q.PlanWaveform(ET_Blink, start, wave);
+
+    Event batch[8];
+    while (VirtualClock::Now() < start + chrono::seconds(10))
+        q.WaitEvents(batch, 8);
+    Time stall = VirtualClock::Now() + chrono::hours(1);
+    VirtualClock::Set(stall);
+    int overdue = 0;
+    Time next;
+    for (;;)
+    {
+        size_t count = q.WaitEvents(batch, 8);
+        if (VirtualClock::Now() != stall)
+        {
+            next = VirtualClock::Now();
+            break;
+        }
+        overdue += int(count);
+    }
+    // Steps start at whole 2 s cycles from start, or 500 ms into one.
+    Duration phase = (next - start) % (on + off);
+    bool ok = (overdue <= 1 && next - stall <= on + off && (phase == Duration() || phase == on));
+    Report("waveform_stall", ok, "overdue=" + to_string(overdue) +
+           " next_ms=" + to_string(chrono::duration_cast<chrono::milliseconds>(next - stall).count()));
+}
+
+// An event whose time has passed rides along on a wakeup even when another
+// one with an earlier deadline, not due yet, comes first in deadline order.
+static void CheckSlackRideAlong()
+{
+    using Queue = BasicEventQueue<VirtualClock>;
+    Time start = Time(chrono::hours(24));
+    VirtualClock::Set(start);
+    Queue q(16);
+    q.PlanEvent(Event(ET_Blink, 0, 0), start + chrono::milliseconds(100));
+    q.PlanEvent(Event(ET_Blink, 0, 1), start + chrono::milliseconds(150));
+    q.PlanEvent(Event(ET_Blink, 0, 2), start + chrono::milliseconds(50), chrono::milliseconds(150));
+
+    Event batch[8];
+    size_t count = q.WaitEvents(batch, 8);
+    Duration woke = VirtualClock::Now() - start;
+    bool ok = (count == 2 && batch[0].Target() == 0 && batch[1].Target() == 2 && woke == chrono::milliseconds(100));
+    Report("slack_ride_along", ok, "batch=" + to_string(count) +
+           " woke_ms=" + to_string(chrono::duration_cast<chrono::milliseconds>(woke).count()));
+}
+
+int main()
+{
+    CheckConfigRejects();
+    CheckWaveformStall();
+    CheckSlackRideAlong();
+    return gFailed;
+}
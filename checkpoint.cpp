@@ -0,0 +1,91 @@
+#include "checkpoint.h"
+#include <cstring>
+
+#ifndef _WIN32
+#  include <unistd.h>
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#endif
+
+using namespace std;
+
+static const uint32_t CheckpointMagic = 0x47524731;    // "GRG1"; change with the layout
+
+CheckpointFile::~CheckpointFile()
+{
+#   ifndef _WIN32
+    if (_map)
+        munmap(_map, 2 * sizeof(Record));
+    if (_fd != -1)
+        close(_fd);
+#   endif
+}
+
+bool CheckpointFile::Open(const char* filename)
+{
+#   ifndef _WIN32
+    _fd = open(filename, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (_fd == -1 || ftruncate(_fd, 2 * sizeof(Record)) != 0)
+        return false;
+    void* map = mmap(nullptr, 2 * sizeof(Record), PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (map == MAP_FAILED)
+        return false;
+    _map = static_cast<Record*>(map);
+    return true;
+#   else
+    (void)filename;
+    return false;
+#   endif
+}
+
+// FNV-1a over the whole record.
+uint32_t CheckpointFile::Checksum(const Record& record)
+{
+    Record copy = record;
+    copy.checksum = 0;
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&copy);
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < sizeof(copy); ++i)
+    {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+const CheckpointFile::Record* CheckpointFile::Newest() const
+{
+    const Record* newest = nullptr;
+    for (int slot = 0; slot < 2; ++slot)
+    {
+        const Record& record = _map[slot];
+        if (record.magic != CheckpointMagic || record.doorCount > MaxDoors || record.checksum != Checksum(record))
+            continue;
+        if (!newest || int32_t(record.sequence - newest->sequence) > 0)
+            newest = &record;
+    }
+    return newest;
+}
+
+bool CheckpointFile::Load(DoorCheckpoint (&doors)[MaxDoors], size_t& count) const
+{
+    const Record* newest = _map ? Newest() : nullptr;
+    if (!newest)
+        return false;
+    count = newest->doorCount;
+    memcpy(doors, newest->doors, sizeof(doors));
+    return true;
+}
+
+void CheckpointFile::Save(const DoorCheckpoint* doors, size_t count)
+{
+    if (!_map || count > MaxDoors)
+        return;
+    const Record* newest = Newest();
+    Record record = {};
+    record.magic = CheckpointMagic;
+    record.sequence = newest ? newest->sequence + 1 : 1;
+    record.doorCount = uint32_t(count);
+    memcpy(record.doors, doors, count * sizeof(DoorCheckpoint));
+    record.checksum = Checksum(record);
+    _map[(newest == &_map[0]) ? 1 : 0] = record;
+}
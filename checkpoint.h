@@ -0,0 +1,59 @@
+#ifndef GUARD_CHECKPOINT_H
+#define GUARD_CHECKPOINT_H
+#include "events.h"
+
+// What a door needs to carry on after the daemon restarts. Times are Clock
+// ticks since its epoch; 0 means unset.
+struct DoorCheckpoint
+{
+    std::uint32_t lightMode;
+    std::uint32_t reserved;
+    std::int64_t lightOnTime;
+    std::int64_t almostOffTime;
+    std::int64_t lightTooLongAt;
+    std::int64_t lightFinalOffAt;
+};
+
+// Door state of the whole host in a small memory-mapped file with a fixed
+// layout: two checksummed records, written alternately, so that a crash in
+// the middle of a write leaves the previous record intact. Saving is a few
+// stores into the mapping with no system call and no fsync; the page cache
+// keeps it across a crash of the process. The file should live on tmpfs
+// (e.g. /run), where a reboot clears it and the doors start from scratch.
+class CheckpointFile
+{
+public:
+    static const std::size_t MaxDoors = EventQueueBase::MaxTargets;
+
+    CheckpointFile() = default;
+    CheckpointFile(const CheckpointFile&) = delete;
+    CheckpointFile& operator=(const CheckpointFile&) = delete;
+    ~CheckpointFile();
+
+    // Maps `filename`, creating it if needed.
+    bool Open(const char* filename);
+    bool IsOpen() const { return _map != nullptr; }
+
+    // Copies the newest intact record to `doors`; false if there is none.
+    bool Load(DoorCheckpoint (&doors)[MaxDoors], std::size_t& count) const;
+
+    void Save(const DoorCheckpoint* doors, std::size_t count);
+
+private:
+    struct Record
+    {
+        std::uint32_t magic;
+        std::uint32_t sequence;
+        std::uint32_t doorCount;
+        std::uint32_t checksum;     // of the record with this field zeroed
+        DoorCheckpoint doors[MaxDoors];
+    };
+
+    static std::uint32_t Checksum(const Record& record);
+    const Record* Newest() const;
+
+    Record* _map = nullptr;     // two slots
+    int _fd = -1;
+};
+
+#endif//GUARD
@@ -0,0 +1,262 @@
+#include "config.h"
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+
+using namespace std;
+
+struct DurationKey
+{
+    const char* key;
+    Duration GaragedConfig::* member;
+};
+
+static const DurationKey DurationKeys[] =
+{
+    { "blink_on_time_ms",                   &GaragedConfig::blinkOnTime },
+    { "blink_off_time_ms",                  &GaragedConfig::blinkOffTime },
+    { "light_final_off_timeout_ms",         &GaragedConfig::lightFinalOffTimeout },
+    { "light_timeout_blink_ms",             &GaragedConfig::lightTimeoutBlink },
+    { "light_too_long_timeout_ms",          &GaragedConfig::lightTooLongTimeout },
+    { "button_halt_time_ms",                &GaragedConfig::buttonHaltTime },
+    { "button_continue_time_ms",            &GaragedConfig::buttonContinueTime },
+    { "display_time_left_time_ms",          &GaragedConfig::displayTimeLeftTime },
+    { "display_time_left_blink_on_time_ms", &GaragedConfig::displayTimeLeftBlinkOnTime },
+    { "display_time_left_blink_off_time_ms", &GaragedConfig::displayTimeLeftBlinkOffTime },
+    { "display_time_left_period_ms",        &GaragedConfig::displayTimeLeftPeriod },
+};
+
+struct PinKey
+{
+    const char* key;
+    int GaragedConfig::* member;
+    bool required;      // may not be none
+};
+
+static const PinKey PinKeys[] =
+{
+    { "relay_pin",          &GaragedConfig::relayPin,       true },
+    { "internal_led_pin",   &GaragedConfig::internalLedPin, false },
+    { "external_led_pin",   &GaragedConfig::externalLedPin, false },
+};
+
+struct ActionName
+{
+    const char* name;
+    InputAction action;
+};
+
+static const ActionName ActionNames[] =
+{
+    { "toggle",             IA_Toggle },
+    { "extend",             IA_Extend },
+    { "instant_on",         IA_InstantOn },
+    { "halt_on_long_press", IA_HaltOnLongPress },
+};
+
+static string Trim(const string& s)
+{
+    size_t begin = s.find_first_not_of(" \t\r");
+    if (begin == string::npos)
+        return string();
+    return s.substr(begin, s.find_last_not_of(" \t\r") - begin + 1);
+}
+
+static bool ParseLong(const string& value, long& result)
+{
+    if (value.empty())
+        return false;
+    char* end;
+    errno = 0;
+    result = strtol(value.c_str(), &end, 10);
+    return errno == 0 && *end == 0;
+}
+
+// Timeouts and blink times must be positive: the waveforms cannot have empty
+// steps and the time left display divides by its period. Nothing needs more
+// than a day, and far more would overflow Duration.
+const long MaxMs = 24L * 3600 * 1000;
+
+static bool ParseMs(const string& value, Duration& result, long minMs = 1)
+{
+    long ms;
+    if (!ParseLong(value, ms) || ms < minMs || ms > MaxMs)
+        return false;
+    result = chrono::milliseconds(ms);
+    return true;
+}
+
+static bool ParsePin(const string& value, int& result, bool required)
+{
+    long pin;
+    if (value == "none" && !required)
+        result = NoPin;
+    else if (ParseLong(value, pin) && pin >= 0 && pin < 64)
+        result = int(pin);
+    else
+        return false;
+    return true;
+}
+
+static bool ParseName(const string& value, char (&result)[MaxNameLength])
+{
+    if (value.size() >= MaxNameLength)
+        return false;
+    strcpy(result, value.c_str());
+    return true;
+}
+
+static bool ParseActions(const string& value, int& result)
+{
+    istringstream words(value);
+    string word;
+    result = 0;
+    while (words >> word)
+    {
+        const ActionName* found = nullptr;
+        for (const ActionName& name : ActionNames)
+        {
+            if (word == name.name)
+                found = &name;
+        }
+        if (!found)
+            return false;
+        result |= found->action;
+    }
+    return true;
+}
+
+static bool ParseInputKey(const string& key, const string& value, InputConfig& input, bool pinRequired)
+{
+    if (key == "name")
+        return ParseName(value, input.name);
+    if (key == "pin")
+        return ParsePin(value, input.pin, pinRequired);
+    if (key == "debounce_ms")
+        return ParseMs(value, input.debounce, 0);
+    if (key == "actions")
+        return ParseActions(value, input.actions);
+    if (key == "active_level")
+    {
+        if (value == "low")
+            input.activeLevel = ActiveLow;
+        else if (value == "high")
+            input.activeLevel = ActiveHigh;
+        else
+            return false;
+        return true;
+    }
+    return false;
+}
+
+static bool ParseKey(const string& key, const string& value, GaragedConfig& door)
+{
+    for (const DurationKey& k : DurationKeys)
+    {
+        if (key == k.key)
+            return ParseMs(value, door.*k.member);
+    }
+    for (const PinKey& k : PinKeys)
+    {
+        if (key == k.key)
+            return ParsePin(value, door.*k.member, k.required);
+    }
+    if (key == "internal_led_name")
+        return ParseName(value, door.internalLedName);
+    if (key.compare(0, 5, "input") == 0 && key.size() > 7 && key[6] == '_')
+    {
+        int channel = key[5] - '0';
+        if (channel < 0 || channel >= MaxInputs)
+            return false;
+        return ParseInputKey(key.substr(7), value, door.inputs[channel], channel == 0);
+    }
+    return false;
+}
+
+static bool ClaimPin(int pin, bool (&used)[64], const GaragedConfig& door, string& error)
+{
+    if (pin == NoPin)
+        return true;
+    if (used[pin])
+    {
+        error = string("door <") + door.name + ">: pin " + to_string(pin) + " used twice";
+        return false;
+    }
+    used[pin] = true;
+    return true;
+}
+
+// Each pin belongs to one relay, LED or input, even across doors.
+static bool CheckPins(const HostConfig& config, string& error)
+{
+    bool used[64] = {};
+    for (size_t d = 0; d < config.doorCount; ++d)
+    {
+        const GaragedConfig& door = config.doors[d];
+        for (const PinKey& k : PinKeys)
+        {
+            if (!ClaimPin(door.*k.member, used, door, error))
+                return false;
+        }
+        for (const InputConfig& input : door.inputs)
+        {
+            if (!ClaimPin(input.pin, used, door, error))
+                return false;
+        }
+    }
+    return true;
+}
+
+bool ParseConfig(istream& in, HostConfig& config, string& error)
+{
+    config.doorCount = 0;
+    string line;
+    for (int number = 1; getline(in, line); ++number)
+    {
+        line = Trim(line.substr(0, line.find('#')));
+        if (line.empty())
+            continue;
+        if (line[0] == '[')
+        {
+            string name = Trim(line.substr(1, line.find(']') - 1));
+            if (line.back() != ']' || config.doorCount == EventQueueBase::MaxTargets)
+            {
+                error = "line " + to_string(number) + ": bad or one too many sections";
+                return false;
+            }
+            GaragedConfig& door = config.doors[config.doorCount++];
+            door = DefaultConfig;
+            if (!ParseName(name, door.name))
+            {
+                error = "line " + to_string(number) + ": name too long";
+                return false;
+            }
+            continue;
+        }
+        size_t equals = line.find('=');
+        if (config.doorCount == 0)
+            config.doors[config.doorCount++] = DefaultConfig;
+        if (equals == string::npos ||
+            !ParseKey(Trim(line.substr(0, equals)), Trim(line.substr(equals + 1)), config.doors[config.doorCount - 1]))
+        {
+            error = "line " + to_string(number) + ": bad setting <" + line + ">";
+            return false;
+        }
+    }
+    if (config.doorCount == 0)
+        config.doors[config.doorCount++] = DefaultConfig;
+    return CheckPins(config, error);
+}
+
+bool LoadConfig(const char* filename, HostConfig& config, string& error)
+{
+    ifstream in(filename);
+    if (!in)
+    {
+        error = string("unable to open ") + filename;
+        return false;
+    }
+    return ParseConfig(in, config, error);
+}
@@ -0,0 +1,34 @@
+#ifndef GUARD_CONFIG_H
+#define GUARD_CONFIG_H
+#include "garaged.h"
+#include <istream>
+#include <string>
+
+// All doors of a host as read from the config file.
+struct HostConfig
+{
+    GaragedConfig doors[EventQueueBase::MaxTargets];
+    std::size_t doorCount = 0;
+};
+
+// The file has one `key = value` per line; # starts a comment. Keys before
+// the first [section] set up a door named "", every [name] section another
+// one; each starts out as DefaultConfig. Keys are the GaragedConfig fields
+// in lower case with underscores, durations with an _ms suffix, and for
+// input channel N the InputConfig fields prefixed with inputN_:
+//
+//   light_too_long_timeout_ms = 1500000
+//   input0_debounce_ms = 100
+//   input2_pin = 33          # PIR sensor
+//   input2_active_level = high
+//   input2_actions = instant_on extend
+//
+// Pins but relay_pin and input0_pin may be `none`, and no pin may be used
+// twice, not even by another door. Durations must be positive and at most a
+// day, debounce times may be 0. Returns false with a message naming the line,
+// or the door for a pin used twice, on the first error; `config` is then
+// unspecified.
+bool ParseConfig(std::istream& in, HostConfig& config, std::string& error);
+bool LoadConfig(const char* filename, HostConfig& config, std::string& error);
+
+#endif//GUARD
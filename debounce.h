@@ -0,0 +1,119 @@
+#ifndef GUARD_DEBOUNCE_H
+#define GUARD_DEBOUNCE_H
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include "histogram.h"
+
+// Debounces one input between the thread that sees its edges (an ISR or the
+// epoll loop) and the thread that handles them, without locks or allocation.
+// Edge records an edge and returns true only for the first one of a burst;
+// its caller plans a single check for quiet time later. The check calls
+// Settle, which either confirms the input has been quiet for that long, so
+// that its level can be read, or tells when to check again. Each settled
+// burst adds its number of edges and its length, first to last edge, to
+// the stats; a switch that wears out shows up as both going up. Edges may
+// carry the level they left the input at, e.g. from the GPIO character
+// device, which saves reading it back once settled.
+template<typename Time>
+class BasicDebouncer
+{
+public:
+    using Duration = typename Time::duration;
+    using DurationHistogram = LogHistogram<Duration>;
+
+    explicit BasicDebouncer(Duration quiet = Duration()) : _quiet(quiet.count()) {}
+    BasicDebouncer(const BasicDebouncer&) = delete;
+    BasicDebouncer& operator=(const BasicDebouncer&) = delete;
+
+    // May be changed at any time; applies from the next edge or check.
+    void SetQuiet(Duration quiet) { _quiet.store(quiet.count(), std::memory_order_relaxed); }
+    Duration Quiet() const { return Duration(_quiet.load(std::memory_order_relaxed)); }
+
+    // Any thread, though edges of one input must not race each other. When
+    // true, the caller must arrange for Settle to be called Quiet() from
+    // `now`. `level` is -1 if unknown.
+    bool Edge(Time now, int level = -1)
+    {
+        _level.store(level, std::memory_order_relaxed);
+        _lastEdge.store(now.time_since_epoch().count(), std::memory_order_seq_cst);
+        _edges.fetch_add(1, std::memory_order_relaxed);
+        if (_armed.exchange(true, std::memory_order_seq_cst))
+            return false;
+        _firstEdge.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+        return true;
+    }
+
+    // The handling thread only. Returns false with the time of the next check
+    // while edges keep coming. A check with no burst pending settles at once,
+    // as of `now`.
+    bool Settle(Time now, Time& again)
+    {
+        std::uint64_t edges = _edges.load(std::memory_order_relaxed);
+        // While the burst goes on it stays armed, so that its later edges
+        // cannot take it for a new one.
+        Time last = Time(Duration(_lastEdge.load(std::memory_order_seq_cst)));
+        if (_armed.load(std::memory_order_seq_cst) && now < last + Quiet())
+        {
+            again = last + Quiet();
+            return false;
+        }
+        // Disarm before looking at the last edge again: an edge that still saw
+        // the burst armed is then either seen here or arms a new one itself.
+        bool armed = _armed.exchange(false, std::memory_order_seq_cst);
+        last = Time(Duration(_lastEdge.load(std::memory_order_seq_cst)));
+        if (armed && now < last + Quiet())
+        {
+            // An edge slipped in since the check above. Take the burst back
+            // unless a later edge has already started a new one, which then
+            // has its own check planned; checking again is harmless either way.
+            bool disarmed = false;
+            _armed.compare_exchange_strong(disarmed, true, std::memory_order_seq_cst);
+            again = last + Quiet();
+            return false;
+        }
+        _settledTime = now;
+        _settledLevel = -1;
+        if (armed)
+        {
+            Time first = Time(Duration(_firstEdge.load(std::memory_order_relaxed)));
+            _settledTime = first;
+            _settledLevel = _level.load(std::memory_order_relaxed);
+            std::uint64_t burstEdges = edges - _settledEdges;
+            _settledEdges = edges;
+            _bursts.fetch_add(1, std::memory_order_relaxed);
+            if (burstEdges > _maxBurstEdges.load(std::memory_order_relaxed))
+                _maxBurstEdges.store(burstEdges, std::memory_order_relaxed);
+            _burstLength.Record(last - first);
+        }
+        return true;
+    }
+
+    // Of the burst last settled: when it started, and the level it left the
+    // input at, -1 if its edges did not carry one. The handling thread only.
+    Time SettledTime() const { return _settledTime; }
+    int SettledLevel() const { return _settledLevel; }
+
+    // Readable from any thread.
+    std::uint64_t Bursts() const { return _bursts.load(std::memory_order_relaxed); }
+    std::uint64_t Edges() const { return _edges.load(std::memory_order_relaxed); }
+    std::uint64_t MaxBurstEdges() const { return _maxBurstEdges.load(std::memory_order_relaxed); }
+    const DurationHistogram& BurstLength() const { return _burstLength; }
+
+private:
+    std::atomic<typename Duration::rep> _quiet;
+    std::atomic<typename Duration::rep> _firstEdge{0};
+    std::atomic<typename Duration::rep> _lastEdge{0};
+    std::atomic<std::uint64_t> _edges{0};
+    std::atomic<int> _level{-1};
+    std::atomic<bool> _armed{false};
+    std::uint64_t _settledEdges = 0;
+    Time _settledTime = Time();
+    int _settledLevel = -1;
+    std::atomic<std::uint64_t> _bursts{0};
+    std::atomic<std::uint64_t> _maxBurstEdges{0};
+    DurationHistogram _burstLength;
+};
+
+#endif//GUARD
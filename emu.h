@@ -1,37 +1,27 @@
 #ifndef GUARD_EMU_H
 #define GUARD_EMU_H
 #pragma once
+#include "garaged.h"
 
-#define LOW 0
-#define HIGH 1
-
-#define OUTPUT 201
-#define INPUT 200
-#define PUD_OFF 300
-#define INT_EDGE_BOTH 400
-
-int Z_system(const char*);
-int digitalRead(int pin);
-void digitalWrite(int pin, int value);
-void wiringPiSetup();
-void pinMode(int pin, int mode);
-void pullUpDnControl(int pin, int pudMode);
-void wiringPiISR(int pin, int edgeMode, void(*handler)());
-struct Z_sysinfo
+// The emulator's board (ui.cpp): outputs are lamps in the window and inputs
+// its buttons, whose edges it reports like the GPIO interrupts would.
+struct EmuHal
 {
-    long uptime;
-    unsigned long loads[3];
-    unsigned long totalram;
-    unsigned long freeram;
-    unsigned long sharedram;
-    unsigned long bufferram;
-    unsigned long totalswap;
-    unsigned long freeswap;
-    unsigned short procs;
-    unsigned long totalhigh;
-    unsigned long freehigh;
-    unsigned int mem_unit;
+    using ClockPolicy = SystemClock;
+
+    static const char* Setup();
+    static void SetOutput(int pin, int level);
+    static void SetInput(int pin);
+    static void Write(const PinLevel* levels, std::size_t count);
+    static int Read(int pin);
+    static void OnEdges(int pin, void (*isr)());
+#   ifdef EVENTS_EPOLL
+    static int OpenEdges(int, EventQueueBase::EdgeFormat&) { return -1; }
+#   endif
+    static int Reboot();
+    static bool ReadSysInfo(SysInfo& info);
 };
-int Z_sysinfo(struct Z_sysinfo* si);
 
-#endif
+using GaragedHost = BasicGaragedHost<EmuHal>;
+
+#endif//GUARD
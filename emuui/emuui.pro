@@ -3,5 +3,5 @@ CONFIG += c++14
 TARGET = emuui
 TEMPLATE = app
 DEFINES += EMU
-HEADERS += ../emu.h ../garaged.h ../events.h
-SOURCES += ../garaged.cpp ../ui.cpp ../events.cpp
+HEADERS += ../emu.h ../hal.h ../outputs.h ../garaged.h ../garaged_impl.h ../events.h ../ring.h ../histogram.h ../waveform.h ../ledclass.h ../config.h ../checkpoint.h ../debounce.h ../pio.h
+SOURCES += ../ui.cpp ../events.cpp ../ledclass.cpp ../config.cpp ../checkpoint.cpp
@@ -1,69 +1,836 @@
 #include "events.h"
+#include "waveform.h"
+#include <new>
+#include <algorithm>
+#ifdef EVENTS_EPOLL
+#  include <system_error>
+#  include <cerrno>
+#  include <unistd.h>
+#  include <sys/epoll.h>
+#  include <sys/eventfd.h>
+#  include <sys/timerfd.h>
+#endif
 using namespace std;
 
 #ifndef EMU
-inline void Z_EventNotify(EventAction, const EventQueue::Entry*){}
+inline void Z_EventNotify(EventAction, const EventQueueBase::Entry*){}
+#else
+void Z_EventNotify(EventAction, const EventQueueBase::Entry*);
 #endif
 
-void EventQueue::PlanEvent(Event event, Duration duration, bool deletePrevious)
+atomic<Duration::rep> VirtualClock::_now{0};
+
+#ifdef EVENTS_COUNT_ALLOCATIONS
+#include <cstdlib>
+
+static atomic<uint64_t> gAllocationCount{0};
+
+uint64_t AllocationCount()
 {
-    PlanEvent(event, Clock::now() + duration, deletePrevious);
+    return gAllocationCount.load(memory_order_relaxed);
 }
 
-void EventQueue::PlanEvent(Event event, Time time, bool deletePrevious)
+void* operator new(size_t size)
 {
+    gAllocationCount.fetch_add(1, memory_order_relaxed);
+    if (void* ptr = malloc(size ? size : 1))
+        return ptr;
+    throw bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    free(ptr);
+}
+#endif
+
+void* EventQueueBase::NodePool::Allocate(size_t size)
+{
+    if (!_storage)
     {
-        lock_guard<mutex> lock(_mutex);
-        Z_EventNotify(EA_New, nullptr);
-        if (deletePrevious)
+        const size_t align = sizeof(max_align_t);
+        _blockSize = (max(size, sizeof(Block)) + align - 1) / align;
+        _storage.reset(new max_align_t[_blockSize * _capacity]);
+        for (size_t i = _capacity; i-- > 0;)
         {
-            EraseFromQueueNotSync(event.Type());
+            Deallocate(&_storage[i * _blockSize]);
         }
-        auto it = _events.emplace(event, time, ++_lastEventNum).first;
-        Z_EventNotify(EA_Plan, &*it);
     }
-    _cv.notify_all();
+    assert(size <= _blockSize * sizeof(max_align_t));
+    if (!_free)
+        throw bad_alloc();
+    Block* block = _free;
+    _free = block->next;
+    return block;
 }
 
-Event EventQueue::WaitEvent()
+void EventQueueBase::NodePool::Deallocate(void* node)
 {
-    unique_lock<mutex> lock(_mutex);
-    Z_EventNotify(EA_Wait, nullptr);
-    while (_events.empty() || _events.begin()->time > Clock::now())
+    Block* block = static_cast<Block*>(node);
+    block->next = _free;
+    _free = block;
+}
+
+EventQueueBase::TimerWheel::Tick EventQueueBase::TimerWheel::ToTick(Time time)
+{
+    auto ms = chrono::duration_cast<chrono::milliseconds>(time.time_since_epoch()).count();
+    return ms > 0 ? Tick(ms) : 0;
+}
+
+size_t EventQueueBase::TimerSet::SoftDue(Time now, Entry** out, size_t room) const
+{
+    size_t count = 0;
+    for (auto it = _entries.begin(); it != _entries.end() && count < room && (*it)->deadline <= now + _maxSlack; ++it)
     {
-        if (_events.empty())
-            _cv.wait(lock);
+        if ((*it)->time <= now)
+            out[count++] = *it;
+    }
+    return count;
+}
+
+void EventQueueBase::TimerWheel::Insert(Entry* entry)
+{
+    if (entry->deadline - entry->time > _maxSlack)
+        _maxSlack = entry->deadline - entry->time;
+    Place(entry);
+    if (_firstKnown && entry->slot != ReadySlot && (!_first || *entry < *_first))
+        _first = entry;
+}
+
+void EventQueueBase::TimerWheel::Remove(Entry* entry)
+{
+    if (entry == _first)
+        _firstKnown = false;
+    Link* next = entry->next;
+    entry->Unlink();
+    if (entry->slot < ReadySlot && next->Empty())
+    {
+        _occupied[entry->slot / Slots] &= ~(std::uint64_t(1) << (entry->slot % Slots));
+    }
+}
+
+void EventQueueBase::TimerWheel::Place(Entry* entry)
+{
+    Tick tick = ToTick(entry->deadline);
+    if (tick <= _current)
+    {
+        Link* pos = &_ready;
+        while (pos->prev != &_ready && *entry < *static_cast<Entry*>(pos->prev))
+        {
+            pos = pos->prev;
+        }
+        entry->slot = ReadySlot;
+        pos->PushBack(entry);
+        return;
+    }
+    int level = (63 - __builtin_clzll(tick ^ _current)) / LevelBits;
+    if (level >= Levels)
+    {
+        entry->slot = OverflowSlot;
+        _overflow.PushBack(entry);
+        return;
+    }
+    int index = int(tick >> (level * LevelBits)) & (Slots - 1);
+    entry->slot = std::uint16_t(level * Slots + index);
+    _slots[level][index].PushBack(entry);
+    _occupied[level] |= std::uint64_t(1) << index;
+}
+
+void EventQueueBase::TimerWheel::Cascade(Link& list)
+{
+    Link pending;
+    if (list.Empty())
+        return;
+    pending.next = list.next;
+    pending.prev = list.prev;
+    pending.next->prev = pending.prev->next = &pending;
+    list.next = list.prev = &list;
+    while (!pending.Empty())
+    {
+        Entry* entry = static_cast<Entry*>(pending.next);
+        entry->Unlink();
+        Place(entry);
+    }
+}
+
+void EventQueueBase::TimerWheel::Advance(Tick target)
+{
+    while (_current < target)
+    {
+        int level = 0;
+        std::uint64_t later = 0;
+        for (; level < Levels; ++level)
+        {
+            int index = int(_current >> (level * LevelBits)) & (Slots - 1);
+            later = (index == Slots - 1) ? 0 : _occupied[level] & (~std::uint64_t(0) << (index + 1));
+            if (later != 0)
+                break;
+        }
+
+        Tick start;
+        if (level < Levels)
+        {
+            int shift = (level + 1) * LevelBits;
+            start = (_current >> shift << shift) | (Tick(__builtin_ctzll(later)) << (level * LevelBits));
+        }
+        else if (!_overflow.Empty())
+        {
+            int shift = Levels * LevelBits;
+            start = ((_current >> shift) + 1) << shift;
+        }
+        else
+        {
+            _current = target;
+            return;
+        }
+
+        if (start > target)
+        {
+            _current = target;
+            return;
+        }
+        _current = start;
+        if (level < Levels)
+        {
+            int index = __builtin_ctzll(later);
+            _occupied[level] &= ~(std::uint64_t(1) << index);
+            Cascade(_slots[level][index]);
+        }
         else
-            _cv.wait_until(lock, _events.begin()->time);
+        {
+            Cascade(_overflow);
+        }
+    }
+}
+
+EventQueueBase::Entry* EventQueueBase::TimerWheel::Front(Time now)
+{
+    Advance(ToTick(now));
+    if (!_ready.Empty())
+        return static_cast<Entry*>(_ready.next);
+    if (_firstKnown)
+        return _first;
+
+    Link* list = &_overflow;
+    for (int level = 0; level < Levels; ++level)
+    {
+        if (_occupied[level] != 0)
+        {
+            list = &_slots[level][__builtin_ctzll(_occupied[level])];
+            break;
+        }
+    }
+    Entry* first = nullptr;
+    for (Link* link = list->next; link != list; link = link->next)
+    {
+        Entry* entry = static_cast<Entry*>(link);
+        if (!first || *entry < *first)
+            first = entry;
+    }
+    _first = first;
+    _firstKnown = true;
+    return first;
+}
+
+// Visits every list, but only once something has been planned with slack.
+size_t EventQueueBase::TimerWheel::SoftDue(Time now, Entry** out, size_t room)
+{
+    size_t count = 0;
+    auto scan = [&](Link& list)
+    {
+        for (Link* link = list.next; link != &list && count < room; link = link->next)
+        {
+            Entry* entry = static_cast<Entry*>(link);
+            if (entry->time <= now)
+                out[count++] = entry;
+        }
+    };
+    if (_maxSlack == Duration() || room == 0)
+        return 0;
+    scan(_ready);
+    for (int level = 0; level < Levels; ++level)
+    {
+        for (std::uint64_t occupied = _occupied[level]; occupied != 0; occupied &= occupied - 1)
+            scan(_slots[level][__builtin_ctzll(occupied)]);
+    }
+    scan(_overflow);
+    sort(out, out + count, EntryLess());
+    return count;
+}
+
+EventQueueBase::EventQueueBase(size_t capacity)
+    : _pool(new Entry[capacity]), _capacity(capacity), _timers{ capacity, capacity, capacity }
+{
+    static_assert(EP_Count == 3, "one timer structure per priority class");
+    for (size_t i = capacity; i-- > 0;)
+    {
+        ReleaseNotSync(&_pool[i]);
+    }
+#   ifdef EVENTS_EPOLL
+    InitPoll();
+#   endif
+}
+
+EventHandle EventQueueBase::PlanEvent(Event event, Time time, bool deletePrevious)
+{
+    return PlanEvent(event, time, Duration(), deletePrevious);
+}
+
+EventHandle EventQueueBase::PlanEvent(Event event, Time time, Duration slack, bool deletePrevious)
+{
+    EventHandle handle;
+    {
+        lock_guard<mutex> lock(_mutex);
+        DrainIngressNotSync();
+        handle = PlanEventNotSync(event, time, slack, deletePrevious);
+    }
+    NotifyWaiter();
+    return handle;
+}
+
+EventHandle EventQueueBase::PlanPeriodic(Event event, Time first, Duration onTime, Duration offTime, Duration slack)
+{
+    assert(onTime > Duration() && offTime > Duration());
+    EventHandle handle;
+    {
+        lock_guard<mutex> lock(_mutex);
+        DrainIngressNotSync();
+        handle = PlanEventNotSync(event, first, slack, false, onTime, offTime);
+    }
+    NotifyWaiter();
+    return handle;
+}
+
+EventHandle EventQueueBase::PlanWaveform(Event event, Time first, const Waveform& wave)
+{
+    std::uint16_t step = wave.FirstStep();
+    EventHandle handle;
+    {
+        lock_guard<mutex> lock(_mutex);
+        DrainIngressNotSync();
+        Event tick(event.Type(), wave.TickData(step), event.Target());
+        handle = PlanEventNotSync(tick, first, wave.At(step).slack, false);
+        if (Entry* entry = FindNotSync(handle))
+        {
+            entry->wave = &wave;
+            entry->step = step;
+        }
+    }
+    NotifyWaiter();
+    return handle;
+}
+
+bool EventQueueBase::Cancel(EventHandle handle)
+{
+    lock_guard<mutex> lock(_mutex);
+    DrainIngressNotSync();
+    Entry* entry = FindNotSync(handle);
+    if (!entry)
+        return false;
+    Z_EventNotify(EA_Delete, entry);
+    RemoveNotSync(entry);
+    return true;
+}
+
+bool EventQueueBase::Reschedule(EventHandle handle, Time time)
+{
+    {
+        lock_guard<mutex> lock(_mutex);
+        DrainIngressNotSync();
+        Entry* entry = FindNotSync(handle);
+        if (!entry || entry->out)
+            return false;
+        Z_EventNotify(EA_Delete, entry);
+        TimersNotSync(entry).Remove(entry);
+        entry->deadline = time + (entry->deadline - entry->time);
+        entry->time = time;
+        TimersNotSync(entry).Insert(entry);
+        Z_EventNotify(EA_Plan, entry);
+    }
+    NotifyWaiter();
+    return true;
+}
+
+void EventQueueBase::PostEventAt(Event event, Time time)
+{
+    Ingress ingress = { event, time };
+    if (!_ingress.Push(ingress))
+    {
+        // Ring is full: fall back to the locked path, preserving order.
+        {
+            lock_guard<mutex> lock(_mutex);
+            DrainIngressNotSync();
+            PlanEventNotSync(ingress.event, ingress.time, Duration(), true);
+        }
+        NotifyWaiter();
+        return;
+    }
+    atomic_thread_fence(memory_order_seq_cst);
+    if (_sleeping.load(memory_order_relaxed))
+    {
+#       ifdef EVENTS_EPOLL
+        uint64_t one = 1;
+        (void)!write(_wakeFd, &one, sizeof(one));
+#       else
+        // The waiter publishes _sleeping under the lock, so taking it here
+        // guarantees it is already blocked in the condition variable.
+        { lock_guard<mutex> lock(_mutex); }
+        _cv.notify_all();
+#       endif
     }
-    Z_EventNotify(EA_Dispatch, &*_events.begin());
-    Event result = _events.begin()->event;
-    _events.erase(_events.begin());
+}
+
+template<typename ClockPolicy>
+Event BasicEventQueue<ClockPolicy>::WaitEvent()
+{
+    unique_lock<mutex> lock(_mutex);
+    Entry* front = WaitDueNotSync(lock);
+    return TakeNotSync(front, ClockPolicy::Now());
+}
+
+template<typename ClockPolicy>
+size_t BasicEventQueue<ClockPolicy>::WaitEvents(Event* events, size_t capacity)
+{
+    unique_lock<mutex> lock(_mutex);
+    Entry* front = WaitDueNotSync(lock);
+    return TakeDueNotSync(front, ClockPolicy::Now(), events, capacity);
+}
+
+Event EventQueueBase::TakeNotSync(Entry* front, Time now)
+{
+    DispatchNotSync(front, now);
+    Event result = front->event;
+    if (RearmNotSync(front, now))
+        return result;
+    UnindexNotSync(front);
+    ReleaseNotSync(front);
     return result;
 }
 
-void EventQueue::DeleteEvents(EventType type)
+size_t EventQueueBase::TakeDueNotSync(Entry* front, Time now, Event* events, size_t capacity)
+{
+    size_t count = 0;
+    auto take = [&](Entry* entry)
+    {
+        DispatchNotSync(entry, now);
+        events[count] = entry->event;
+        entry->out = &events[count];
+        _inFlight.PushBack(entry);
+        ++count;
+    };
+    do
+    {
+        take(front);
+    }
+    while (count < capacity && (front = FrontNotSync(now)) != nullptr && front->time <= now);
+
+    // What is left of the batch goes to entries whose time has passed behind
+    // an earlier deadline that is not due yet.
+    for (Timers& timers : _timers)
+    {
+        Entry* softDue[16];
+        size_t found = timers.SoftDue(now, softDue, min<size_t>(capacity - count, 16));
+        for (size_t i = 0; i < found; ++i)
+            take(softDue[i]);
+    }
+    return count;
+}
+
+void EventQueueBase::DeleteEvents(EventType type, uint8_t target)
 {
     {
         lock_guard<mutex> lock(_mutex);
+        DrainIngressNotSync();
         Z_EventNotify(EA_New, nullptr);
-        EraseFromQueueNotSync(type);
+        EraseFromQueueNotSync(type, target);
     }
+    NotifyWaiter();
+}
+
+template<typename ClockPolicy>
+EventQueueBase::Entry* BasicEventQueue<ClockPolicy>::WaitDueNotSync(unique_lock<mutex>& lock)
+{
+    RetireInFlightNotSync(ClockPolicy::Now());
+    Z_EventNotify(EA_Wait, nullptr);
+    for (;;)
+    {
+        DrainIngressNotSync();
+        Time now = ClockPolicy::Now();
+        Entry* front = FrontNotSync(now);
+        if (front && front->time <= now)
+            return front;
+
+        _sleeping.store(true, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (_ingress.Empty())
+        {
+            if (!front || !ClockPolicy::SkipTo(front->deadline))
+                BlockNotSync(lock, front, &ClockPolicy::Now);
+            ++_stats.wakeups;
+        }
+        _sleeping.store(false, memory_order_relaxed);
+    }
+}
+
+#ifndef EVENTS_EPOLL
+
+void EventQueueBase::BlockNotSync(unique_lock<mutex>& lock, Entry* front, Time (*)())
+{
+    if (!front)
+        _cv.wait(lock);
+    else
+        _cv.wait_until(lock, front->deadline);
+}
+
+void EventQueueBase::NotifyWaiter()
+{
     _cv.notify_all();
 }
 
-void EventQueue::EraseFromQueueNotSync(EventType type)
+#else
+
+static void CheckSys(bool ok, const char* what)
 {
-    for (auto it = _events.begin(); it != _events.end();)
+    if (!ok)
+        throw system_error(errno, system_category(), what);
+}
+
+void EventQueueBase::InitPoll()
+{
+    _epollFd = epoll_create1(EPOLL_CLOEXEC);
+    CheckSys(_epollFd != -1, "epoll_create1");
+    _timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    CheckSys(_timerFd != -1, "timerfd_create");
+    _wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    CheckSys(_wakeFd != -1, "eventfd");
+
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u32 = PS_Timer;
+    CheckSys(epoll_ctl(_epollFd, EPOLL_CTL_ADD, _timerFd, &ev) == 0, "epoll_ctl");
+    ev.data.u32 = PS_Wake;
+    CheckSys(epoll_ctl(_epollFd, EPOLL_CTL_ADD, _wakeFd, &ev) == 0, "epoll_ctl");
+}
+
+EventQueueBase::~EventQueueBase()
+{
+    for (size_t i = 0; i < _edgeCount; ++i)
+        close(_edges[i].fd);
+    close(_wakeFd);
+    close(_timerFd);
+    close(_epollFd);
+}
+
+bool EventQueueBase::WatchEdges(int fd, Event event, Debouncer& debouncer, EdgeFormat format)
+{
+    lock_guard<mutex> lock(_mutex);
+    if (fd < 0 || _edgeCount == MaxEdgeSources)
+        return false;
+#   ifndef EVENTS_LINE_EVENTS
+    if (format == EF_LineEvents)
+        return false;
+#   endif
+    epoll_event ev = {};
+    ev.events = (format == EF_LineEvents) ? EPOLLIN : (EPOLLPRI | EPOLLERR);
+    ev.data.u32 = PS_Edge + std::uint32_t(_edgeCount);
+    if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &ev) != 0)
+        return false;
+    _edges[_edgeCount++] = { fd, event, &debouncer, format };
+    return true;
+}
+
+// Called with the lock held; releases it only for the duration of epoll_wait.
+void EventQueueBase::BlockNotSync(unique_lock<mutex>& lock, Entry* front, Time (*now)())
+{
+    itimerspec spec = {};
+    if (front)
     {
-        if (it->event.Type() == type)
+        auto ns = chrono::duration_cast<chrono::nanoseconds>(front->deadline.time_since_epoch()).count();
+        spec.it_value.tv_sec = ns / 1000000000;
+        spec.it_value.tv_nsec = ns % 1000000000;
+    }
+    timerfd_settime(_timerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+
+    epoll_event events[PS_Edge + MaxEdgeSources];
+    lock.unlock();
+    int count = epoll_wait(_epollFd, events, PS_Edge + MaxEdgeSources, -1);
+    lock.lock();
+
+    Time edgeTime = count > 0 ? now() : Time();
+    for (int i = 0; i < count; ++i)
+    {
+        std::uint32_t source = events[i].data.u32;
+        if (source == PS_Timer || source == PS_Wake)
+        {
+            uint64_t value;
+            (void)!read(source == PS_Timer ? _timerFd : _wakeFd, &value, sizeof(value));
+        }
+#       ifdef EVENTS_LINE_EVENTS
+        else if (_edges[source - PS_Edge].format == EF_LineEvents)
         {
-            Z_EventNotify(EA_Delete, &*it);
-            it = _events.erase(it);
+            const EdgeSource& edge = _edges[source - PS_Edge];
+            gpio_v2_line_event records[16];
+            ssize_t len;
+            while ((len = read(edge.fd, records, sizeof(records))) > 0)
+            {
+                for (size_t r = 0; r < size_t(len) / sizeof(records[0]); ++r)
+                {
+                    Time time = Time(chrono::duration_cast<Duration>(chrono::nanoseconds(records[r].timestamp_ns)));
+                    int level = (records[r].id == GPIO_V2_LINE_EVENT_RISING_EDGE) ? 1 : 0;
+                    if (edge.debouncer->Edge(time, level))
+                        PlanEventNotSync(edge.event, time + edge.debouncer->Quiet(), Duration(), true);
+                }
+            }
         }
+#       endif
         else
         {
-            ++it;
+            // sysfs GPIO: reading the value from the start re-arms the edge.
+            const EdgeSource& edge = _edges[source - PS_Edge];
+            char value[8];
+            lseek(edge.fd, 0, SEEK_SET);
+            (void)!read(edge.fd, value, sizeof(value));
+            if (edge.debouncer->Edge(edgeTime))
+                PlanEventNotSync(edge.event, edgeTime + edge.debouncer->Quiet(), Duration(), true);
         }
     }
 }
+
+void EventQueueBase::NotifyWaiter()
+{
+    if (_sleeping.load(memory_order_relaxed))
+    {
+        uint64_t one = 1;
+        (void)!write(_wakeFd, &one, sizeof(one));
+    }
+}
+
+#endif
+
+// Periodic and waveform entries dispatched by WaitEvents are only re-armed
+// here, so that until the next wait they can still be cancelled like any other.
+void EventQueueBase::RetireInFlightNotSync(Time now)
+{
+    while (!_inFlight.Empty())
+    {
+        Entry* entry = static_cast<Entry*>(_inFlight.next);
+        entry->Unlink();
+        entry->out = nullptr;
+        if (RearmNotSync(entry, now))
+            continue;
+        UnindexNotSync(entry);
+        ReleaseNotSync(entry);
+    }
+}
+
+// Moves a dispatched periodic or waveform entry on to its next tick; returns
+// false for one-shot entries and finished waveforms, which are released.
+bool EventQueueBase::RearmNotSync(Entry* entry, Time now)
+{
+    Time base = (entry->time == Time()) ? now : entry->time;
+    if (entry->wave)
+    {
+        const Waveform& wave = *entry->wave;
+        Time next = base + wave.At(entry->step).duration;
+        if (!wave.Advance(entry->step, entry->pass))
+            return false;
+        if (next <= now && entry->step < wave.BodySteps())
+        {
+            // Skips whole passes of the body missed in a stall, keeping the
+            // phase, but not beyond the last pass.
+            Duration body = wave.BodyDuration();
+            Duration::rep passes = (now - next) / body + 1;
+            if (wave.Repeats() != Waveform::Forever)
+            {
+                passes = min<Duration::rep>(passes, wave.Repeats() - 1 - entry->pass);
+                entry->pass += std::uint16_t(passes);
+            }
+            next += passes * body;
+        }
+        entry->event = Event(entry->event.Type(), wave.TickData(entry->step), entry->event.Target());
+        entry->time = next;
+        entry->deadline = next + wave.At(entry->step).slack;
+        TimersNotSync(entry).Insert(entry);
+        Z_EventNotify(EA_Plan, entry);
+        return true;
+    }
+    if (entry->onTime == Duration())
+        return false;
+
+    Duration slack = entry->deadline - entry->time;
+    bool on = (entry->event.Data() & 1) != 0;
+    Time next = base + (on ? entry->onTime : entry->offTime);
+    if (next <= now)
+    {
+        Duration cycle = entry->onTime + entry->offTime;
+        next += ((now - next) / cycle + 1) * cycle;
+    }
+    entry->event = Event(entry->event.Type(), on ? 0 : 1, entry->event.Target());
+    entry->time = next;
+    entry->deadline = next + slack;
+    TimersNotSync(entry).Insert(entry);
+    Z_EventNotify(EA_Plan, entry);
+    return true;
+}
+
+void EventQueueBase::DispatchNotSync(Entry* entry, Time now)
+{
+    Z_EventNotify(EA_Dispatch, entry);
+    EventPriority priority = GetEventPriority(entry->event.Type());
+    _timers[priority].Remove(entry);
+    ++_stats.dispatched;
+    if (now < entry->deadline)
+        ++_stats.coalesced;
+
+    // Events planned for Time() mean "as soon as possible" and are never late.
+    bool asap = (entry->time == Time());
+    if (!asap)
+        _lateness[entry->event.Type()].Record(now - entry->time);
+    ClassStats& classStats = _stats.classes[priority];
+    ++classStats.dispatched;
+    Duration lateness = asap ? Duration() : now - entry->deadline;
+    if (lateness > _budgets[priority])
+        ++classStats.overBudget;
+    if (lateness > classStats.maxLateness)
+        classStats.maxLateness = lateness;
+}
+
+// The due entry of the highest class or, if nothing is due yet, the entry
+// with the earliest deadline to sleep until.
+EventQueueBase::Entry* EventQueueBase::FrontNotSync(Time now)
+{
+    Entry* first = nullptr;
+    for (Timers& timers : _timers)
+    {
+        Entry* front = timers.Front(now);
+        if (front && front->time <= now)
+            return front;
+        if (front && (!first || *front < *first))
+            first = front;
+    }
+    return first;
+}
+
+void EventQueueBase::SetLatencyBudget(EventPriority priority, Duration budget)
+{
+    lock_guard<mutex> lock(_mutex);
+    _budgets[priority] = budget;
+}
+
+EventQueueBase::Stats EventQueueBase::GetStats()
+{
+    lock_guard<mutex> lock(_mutex);
+    return _stats;
+}
+
+EventHandle EventQueueBase::PlanEventNotSync(Event event, Time time, Duration slack, bool deletePrevious,
+                                             Duration onTime, Duration offTime)
+{
+    Z_EventNotify(EA_New, nullptr);
+    if (deletePrevious)
+    {
+        EraseFromQueueNotSync(event.Type(), event.Target());
+    }
+    Entry* entry = _free;
+    if (!entry)
+    {
+        ++_stats.dropped;
+        return EventHandle();
+    }
+    _free = entry->typeNext;
+    entry->event = event;
+    entry->time = time;
+    entry->deadline = time + slack;
+    entry->onTime = onTime;
+    entry->offTime = offTime;
+    entry->wave = nullptr;
+    entry->pass = 0;
+    entry->num = ++_lastEventNum;
+    TimersNotSync(entry).Insert(entry);
+    IndexNotSync(entry);
+    Z_EventNotify(EA_Plan, entry);
+    return EventHandle(uint32_t(entry - _pool.get()), entry->num);
+}
+
+EventQueueBase::Entry* EventQueueBase::FindNotSync(EventHandle handle)
+{
+    if (!handle || handle._index >= _capacity)
+        return nullptr;
+    Entry* entry = &_pool[handle._index];
+    return entry->num == handle._num ? entry : nullptr;
+}
+
+void EventQueueBase::RemoveNotSync(Entry* entry)
+{
+    if (entry->out)
+    {
+        *entry->out = Event();
+        entry->out = nullptr;
+        entry->Unlink();
+    }
+    else
+    {
+        TimersNotSync(entry).Remove(entry);
+    }
+    UnindexNotSync(entry);
+    ReleaseNotSync(entry);
+}
+
+void EventQueueBase::DrainIngressNotSync()
+{
+    Ingress ingress;
+    while (_ingress.Pop(ingress))
+    {
+        PlanEventNotSync(ingress.event, ingress.time, Duration(), true);
+    }
+}
+
+void EventQueueBase::ReleaseNotSync(Entry* entry)
+{
+    entry->num = 0;
+    entry->typeNext = _free;
+    _free = entry;
+}
+
+EventQueueBase::Entry*& EventQueueBase::IndexHeadNotSync(Event event)
+{
+    assert(event.Target() < MaxTargets);
+    return _byType[event.Target()][event.Type()];
+}
+
+void EventQueueBase::IndexNotSync(Entry* entry)
+{
+    Entry*& head = IndexHeadNotSync(entry->event);
+    entry->typePrev = nullptr;
+    entry->typeNext = head;
+    if (head)
+        head->typePrev = entry;
+    head = entry;
+}
+
+void EventQueueBase::UnindexNotSync(Entry* entry)
+{
+    if (entry->typePrev)
+        entry->typePrev->typeNext = entry->typeNext;
+    else
+        IndexHeadNotSync(entry->event) = entry->typeNext;
+    if (entry->typeNext)
+        entry->typeNext->typePrev = entry->typePrev;
+}
+
+void EventQueueBase::EraseFromQueueNotSync(EventType type, uint8_t target)
+{
+    while (Entry* entry = IndexHeadNotSync(Event(type, 0, target)))
+    {
+        Z_EventNotify(EA_Delete, entry);
+        RemoveNotSync(entry);
+    }
+}
+
+template class BasicEventQueue<SystemClock>;
+template class BasicEventQueue<VirtualClock>;
@@ -6,28 +6,87 @@
 #include <chrono>
 #include <cassert>
 #include <set>
+#include <memory>
 #include <mutex>
+#include <atomic>
 #include <condition_variable>
+#include "ring.h"
+#include "histogram.h"
+#include "debounce.h"
+
+// With -DEVENTS_EPOLL, edges can also come from the GPIO character device,
+// but only where the kernel headers have its v2 uAPI; older ones, e.g. the
+// 3.4 board kernel's, leave EVENTS_LINE_EVENTS undefined and sysfs only.
+#ifdef EVENTS_EPOLL
+#  ifdef __has_include
+#    if __has_include(<linux/gpio.h>)
+#      include <linux/gpio.h>
+#    endif
+#  endif
+#  ifdef GPIO_V2_GET_LINE_IOCTL
+#    define EVENTS_LINE_EVENTS
+#  endif
+#endif
 
 using Clock = std::conditional_t<std::chrono::high_resolution_clock::is_steady, std::chrono::high_resolution_clock, std::chrono::steady_clock>;
 using Time = Clock::time_point;
 using Duration = Clock::duration;
 
 using EventId = std::uint64_t;
+using Debouncer = BasicDebouncer<Time>;
+
+// Clock policies for BasicEventQueue/BasicGaraged. Both report Time on the
+// steady clock's scale. SkipTo is called when the queue would otherwise sleep
+// until `deadline`; returning true means time has been moved there instead.
+struct SystemClock
+{
+    static Time Now() { return Clock::now(); }
+    static bool SkipTo(Time) { return false; }
+};
+
+// Simulated time shared by everything in the process: it only moves when set
+// or when a queue with nothing runnable skips to its next deadline, so a day
+// of timers runs as fast as the events can be handled.
+class VirtualClock
+{
+public:
+    static Time Now() { return Time(Duration(_now.load(std::memory_order_acquire))); }
+    static void Set(Time time) { _now.store(time.time_since_epoch().count(), std::memory_order_release); }
+    static bool SkipTo(Time deadline)
+    {
+        if (deadline > Now())
+            Set(deadline);
+        return true;
+    }
+
+private:
+    static std::atomic<Duration::rep> _now;
+};
 
 enum EventType
 {
     ET_Null,
     ET_Blink,
-    ET_Button,
-    ET_Gate,
+    ET_Input0,          // edges of input channel i are ET_Input0 + i
+    ET_Input1,
+    ET_Input2,
+    ET_Input3,
     ET_LightFinalOff,
     ET_BlinkExternal,
     ET_LightTooLong,
     ET_Halt,
     ET_WriteStats,
-    ET_DisplayTimeLeft,
-    ET_DisplayTimeLeftBlink,
+    ET_Reload,
+    ET_Count,
+};
+
+// Among due events the lower class is dispatched first, whatever their times.
+enum EventPriority
+{
+    EP_Safety,
+    EP_Control,
+    EP_Cosmetic,
+    EP_Count,
 };
 
 enum EventAction
@@ -46,69 +105,491 @@ inline const char* GetEventName(EventType evt)
     {
     case ET_Null:            return "Null";
     case ET_Blink:           return "Blink";
-    case ET_Button:          return "Button";
-    case ET_Gate:            return "Gate";
+    case ET_Input0:          return "Input0";
+    case ET_Input1:          return "Input1";
+    case ET_Input2:          return "Input2";
+    case ET_Input3:          return "Input3";
     case ET_LightFinalOff:    return "LightTimeout";
     case ET_BlinkExternal:   return "BlinkExternal";
     case ET_LightTooLong:    return "LightTooLong";
     case ET_Halt:            return "Halt";
     case ET_WriteStats:      return "WriteStats";
-    case ET_DisplayTimeLeft: return "DisplayTimeLeft";
-    case ET_DisplayTimeLeftBlink: return "DisplayTimeLeftBlink";
+    case ET_Reload:          return "Reload";
+    case ET_Count:           break;
+    }
+    assert(0);
+    return nullptr;
+}
+
+// The class an event type is dispatched in; see EventPriority.
+inline EventPriority GetEventPriority(EventType evt)
+{
+    switch (evt)
+    {
+    case ET_Input0:
+    case ET_Input1:
+    case ET_Input2:
+    case ET_Input3:
+    case ET_LightFinalOff:
+    case ET_Halt:
+        return EP_Safety;
+    case ET_LightTooLong:
+    case ET_Reload:
+        return EP_Control;
+    default:
+        return EP_Cosmetic;
+    }
+}
+
+inline const char* GetPriorityName(EventPriority priority)
+{
+    switch (priority)
+    {
+    case EP_Safety:   return "Safety";
+    case EP_Control:  return "Control";
+    case EP_Cosmetic: return "Cosmetic";
+    case EP_Count:    break;
     }
     assert(0);
     return nullptr;
 }
 
+// Target tells which of several consumers sharing a queue the event is for;
+// the queue keeps same-typed events of different targets apart.
 class Event
 {
 public:
     EventType Type() const { return _type; }
     std::uint32_t Data() const { return _data; }
+    std::uint8_t Target() const { return _target; }
 
-    Event(EventType type = ET_Null, std::uint32_t data = 0) : _type(type), _data(data) {}
+    Event(EventType type = ET_Null, std::uint32_t data = 0, std::uint8_t target = 0) : _type(type), _data(data), _target(target) {}
 private:
     EventType _type;
     std::uint32_t _data;
+    std::uint8_t _target;
 };
 
-class EventQueue
+// Identifies one planned event; stays valid until the event is dispatched
+// (or, for WaitEvents, until the following wait), cancelled or deleted.
+class EventHandle
 {
+public:
+    EventHandle() = default;
+
+    explicit operator bool() const { return _num != 0; }
+
 private:
-    
-    struct Entry
+    friend class EventQueueBase;
+
+    EventHandle(std::uint32_t index, EventId num) : _index(index), _num(num) {}
+
+    std::uint32_t _index = 0;
+    EventId _num = 0;
+};
+
+class Waveform;
+
+// The pending timers are kept either in a hierarchical timing wheel (default)
+// or, when built with -DEVENTS_TIMER_SET, in the original std::set.
+// The waiting thread blocks in a condition variable, or with -DEVENTS_EPOLL
+// (Linux only) in epoll_wait on a timerfd, an eventfd for other threads and
+// any GPIO edge descriptors registered with WatchEdges.
+// Everything that does not depend on the clock lives in EventQueueBase; the
+// waiting and duration-based planning are in BasicEventQueue<ClockPolicy>.
+class EventQueueBase
+{
+protected:
+
+    struct Link
+    {
+        Link* prev = this;
+        Link* next = this;
+
+        bool Empty() const { return next == this; }
+
+        void PushBack(Link* node)
+        {
+            node->prev = prev;
+            node->next = this;
+            prev->next = node;
+            prev = node;
+        }
+
+        void Unlink()
+        {
+            prev->next = next;
+            next->prev = prev;
+            prev = next = this;
+        }
+    };
+
+    struct Entry : Link
     {
         Event event;
         Time time;
-        EventId num;
-
-        Entry(Event event, Time time, EventId num)
-            : event(event), time(time), num(num) {}
+        Time deadline;
+        Duration onTime = Duration();   // both set for periodic entries
+        Duration offTime = Duration();
+        const Waveform* wave = nullptr; // set for waveform entries
+        std::uint16_t step = 0;
+        std::uint16_t pass = 0;
+        EventId num = 0;
+        std::uint16_t slot = 0;
+        Entry* typePrev = nullptr;
+        Entry* typeNext = nullptr;
+        Event* out = nullptr;
 
         bool operator<(const Entry& rhs) const
         {
-            return time < rhs.time || (time == rhs.time && num < rhs.num);
+            return deadline < rhs.deadline || (deadline == rhs.deadline && num < rhs.num);
+        }
+    };
+    friend void Z_EventNotify(EventAction, const EventQueueBase::Entry*);
+
+    struct EntryLess
+    {
+        bool operator()(const Entry* lhs, const Entry* rhs) const { return *lhs < *rhs; }
+    };
+
+    // Fixed-size blocks for std::set nodes. The node size is only known at the
+    // first allocation, so the storage for all of them is reserved then; each
+    // TimerSet makes one as it is constructed.
+    class NodePool
+    {
+    public:
+        explicit NodePool(std::size_t capacity) : _capacity(capacity) {}
+
+        void* Allocate(std::size_t size);
+        void Deallocate(void* node);
+
+    private:
+        struct Block { Block* next; };
+
+        std::size_t _capacity;
+        std::size_t _blockSize = 0;
+        std::unique_ptr<std::max_align_t[]> _storage;
+        Block* _free = nullptr;
+    };
+
+    template<typename T>
+    struct NodeAllocator
+    {
+        using value_type = T;
+
+        NodePool* pool;
+
+        explicit NodeAllocator(NodePool* pool) : pool(pool) {}
+        template<typename U>
+        NodeAllocator(const NodeAllocator<U>& other) : pool(other.pool) {}
+
+        T* allocate(std::size_t n)
+        {
+            assert(n == 1);
+            return static_cast<T*>(pool->Allocate(n * sizeof(T)));
         }
+        void deallocate(T* node, std::size_t) { pool->Deallocate(node); }
+
+        template<typename U>
+        bool operator==(const NodeAllocator<U>& rhs) const { return pool == rhs.pool; }
+        template<typename U>
+        bool operator!=(const NodeAllocator<U>& rhs) const { return pool != rhs.pool; }
+    };
+
+    class TimerSet
+    {
+    public:
+        TimerSet(std::size_t capacity)
+            : _nodes(capacity), _entries(EntryLess(), NodeAllocator<Entry*>(&_nodes))
+        {
+            _entries.erase(_entries.insert(nullptr).first);
+        }
+
+        void Insert(Entry* entry)
+        {
+            _entries.insert(entry);
+            if (entry->deadline - entry->time > _maxSlack)
+                _maxSlack = entry->deadline - entry->time;
+        }
+        void Remove(Entry* entry) { _entries.erase(entry); }
+        Entry* Front(Time) const { return _entries.empty() ? nullptr : *_entries.begin(); }
+        std::size_t SoftDue(Time now, Entry** out, std::size_t room) const;
+
+    private:
+        NodePool _nodes;
+        std::set<Entry*, EntryLess, NodeAllocator<Entry*>> _entries;
+        Duration _maxSlack = Duration();    // the most ever inserted
     };
-    friend void Z_EventNotify(EventAction, const EventQueue::Entry*);
+
+    // Entries due at or before the current tick are kept sorted in _ready,
+    // later ones are hashed by tick into Levels wheels of Slots each. An entry
+    // sits on the level of the highest bit group in which its tick differs from
+    // the current one, so every level is strictly later than the one below it.
+    class TimerWheel
+    {
+    public:
+        TimerWheel(std::size_t) {}
+
+        void Insert(Entry* entry);
+        void Remove(Entry* entry);
+        Entry* Front(Time now);
+        std::size_t SoftDue(Time now, Entry** out, std::size_t room);
+
+    private:
+        using Tick = std::uint64_t;
+
+        static const int LevelBits = 6;
+        static const int Slots = 1 << LevelBits;
+        static const int Levels = 5;
+        static const std::uint16_t ReadySlot = Levels * Slots;
+        static const std::uint16_t OverflowSlot = ReadySlot + 1;
+
+        static Tick ToTick(Time time);
+
+        void Place(Entry* entry);
+        void Cascade(Link& list);
+        void Advance(Tick target);
+
+        Link _ready;
+        Link _slots[Levels][Slots];
+        std::uint64_t _occupied[Levels] = {};
+        Link _overflow;
+        Tick _current = 0;
+        Entry* _first = nullptr;    // earliest entry outside _ready, if known
+        bool _firstKnown = false;
+        Duration _maxSlack = Duration();    // the most ever inserted
+    };
+
+    // Both keep entries in deadline order for Front. SoftDue copies up to
+    // `room` entries whose time has passed but whose deadline has not, which
+    // Front can hide behind an earlier deadline that is not due yet.
+#ifdef EVENTS_TIMER_SET
+    using Timers = TimerSet;
+#else
+    using Timers = TimerWheel;
+#endif
 
 public:
-    void PlanEvent(Event event, Duration duration, bool deletePrevious = false);
+    static const std::size_t DefaultCapacity = 256;
+    static const std::size_t MaxTargets = 8;
 
-    void PlanEvent(Event event, Time time = Time(), bool deletePrevious = false);
+    // All entries are preallocated here; once `capacity` events are pending,
+    // further plans are dropped and counted in Stats::dropped.
+    explicit EventQueueBase(std::size_t capacity = DefaultCapacity);
+    EventQueueBase(const EventQueueBase&) = delete;
+    EventQueueBase& operator=(const EventQueueBase&) = delete;
+#ifdef EVENTS_EPOLL
+    ~EventQueueBase();
 
-    Event WaitEvent();
+    enum EdgeFormat
+    {
+        EF_SysfsValue,  // a sysfs GPIO value file: edges are timed when seen
+        EF_LineEvents,  // gpio_v2_line_event records, timed and levelled by the kernel
+    };
 
-    void DeleteEvents(EventType type);
+    // Takes ownership of a GPIO descriptor; edges on it go to `debouncer`,
+    // and the first of each burst plans `event` after its quiet time. The
+    // handler of `event` then settles the burst. EF_LineEvents descriptors
+    // must be non-blocking; any other such descriptor, e.g. a pipe, that
+    // yields the same records will do. Without EVENTS_LINE_EVENTS they are
+    // refused.
+    bool WatchEdges(int fd, Event event, Debouncer& debouncer, EdgeFormat format = EF_SysfsValue);
+#endif
 
-private:
-    void EraseFromQueueNotSync(EventType type);
+    EventHandle PlanEvent(Event event, Time time = Time(), bool deletePrevious = false);
+
+    // With slack the event may be dispatched anywhere in [time, time + slack],
+    // so that it can share a wakeup with other events due around then.
+    EventHandle PlanEvent(Event event, Time time, Duration slack, bool deletePrevious = false);
+
+    // Periodic timer: `event` is dispatched at `first` and then again and
+    // again until cancelled, with the low bit of Data() as the phase. A tick
+    // with phase 1 is followed by one with phase 0 after onTime, which is
+    // followed by phase 1 after offTime. Ticks are re-armed inside the queue
+    // against the original phase, so lateness never accumulates; after a
+    // stall only one overdue tick is delivered and the missed ones are
+    // skipped. ASAP periodic timers take their phase from their first dispatch.
+    EventHandle PlanPeriodic(Event event, Time first, Duration onTime, Duration offTime, Duration slack = Duration());
+
+    // Plays `wave` from a single entry: every step is dispatched as `event`
+    // with the step's WaveLevel in Data(), the end as a tick with WaveEnd.
+    // Steps are timed from the previous one's planned time, like periodic
+    // ticks, and likewise after a stall the body skips the passes it missed,
+    // so only one overdue step is delivered. `wave` must stay alive and
+    // unchanged until the entry is gone.
+    EventHandle PlanWaveform(Event event, Time first, const Waveform& wave);
+
+    // Both return false if the event is no longer pending. Rescheduling keeps
+    // the EventId, so among events due at the same time it keeps its place.
+    bool Cancel(EventHandle handle);
+    bool Reschedule(EventHandle handle, Time time);
+
+    void DeleteEvents(EventType type, std::uint8_t target = 0);
+
+    // How far past its deadline an event of this class may be dispatched
+    // before it counts in ClassStats::overBudget.
+    void SetLatencyBudget(EventPriority priority, Duration budget);
+
+    struct ClassStats
+    {
+        std::uint64_t dispatched = 0;
+        std::uint64_t overBudget = 0;
+        Duration maxLateness = Duration();  // past the deadline
+    };
+
+    struct Stats
+    {
+        std::uint64_t wakeups = 0;      // returns from a blocking wait
+        std::uint64_t dispatched = 0;
+        std::uint64_t coalesced = 0;    // dispatched early, inside their slack
+        std::uint64_t dropped = 0;
+        ClassStats classes[EP_Count];
+    };
+
+    Stats GetStats();
+
+    // How late events of a type were dispatched relative to their planned
+    // time, excluding ASAP ones. Lock-free: may be read from any thread.
+    using LatenessHistogram = LogHistogram<Duration>;
+    const LatenessHistogram& Lateness(EventType type) const { return _lateness[type]; }
+
+protected:
+    // Lock-free part of PostEvent; see BasicEventQueue::PostEvent.
+    void PostEventAt(Event event, Time time);
+
+    Event TakeNotSync(Entry* front, Time now);
+    std::size_t TakeDueNotSync(Entry* front, Time now, Event* events, std::size_t capacity);
+    void BlockNotSync(std::unique_lock<std::mutex>& lock, Entry* front, Time (*now)());
+
+    struct Ingress
+    {
+        Event event;
+        Time time;
+    };
+
+    static const std::size_t IngressCapacity = 64;
+
+    EventHandle PlanEventNotSync(Event event, Time time, Duration slack, bool deletePrevious,
+                                 Duration onTime = Duration(), Duration offTime = Duration());
+    bool RearmNotSync(Entry* entry, Time now);
+    Timers& TimersNotSync(const Entry* entry) { return _timers[GetEventPriority(entry->event.Type())]; }
+    Entry* FrontNotSync(Time now);
+    void DispatchNotSync(Entry* entry, Time now);
+    Entry* FindNotSync(EventHandle handle);
+    void RemoveNotSync(Entry* entry);
+    void NotifyWaiter();
+    void RetireInFlightNotSync(Time now);
+    void DrainIngressNotSync();
+    void ReleaseNotSync(Entry* entry);
+    void IndexNotSync(Entry* entry);
+    void UnindexNotSync(Entry* entry);
+    Entry*& IndexHeadNotSync(Event event);
+    void EraseFromQueueNotSync(EventType type, std::uint8_t target);
 
     std::mutex _mutex;
     std::condition_variable _cv;
-    std::set<Entry> _events;
+    std::unique_ptr<Entry[]> _pool;
+    std::size_t _capacity;
+    Entry* _free = nullptr;
+    Stats _stats;
+    Timers _timers[EP_Count];
+    Duration _budgets[EP_Count] = {};
+    LatenessHistogram _lateness[ET_Count];
+    Link _inFlight;
+    Entry* _byType[MaxTargets][ET_Count] = {};
     EventId _lastEventNum = 0;
+    MpscRing<Ingress, IngressCapacity> _ingress;
+    std::atomic<bool> _sleeping{false};
+
+#ifdef EVENTS_EPOLL
+    enum PollSource
+    {
+        PS_Timer,
+        PS_Wake,
+        PS_Edge,
+    };
+
+    struct EdgeSource
+    {
+        int fd;
+        Event event;
+        Debouncer* debouncer;
+        EdgeFormat format;
+    };
+
+    static const std::size_t MaxEdgeSources = (ET_Input3 - ET_Input0 + 1) * MaxTargets;
+
+    void InitPoll();
+
+    int _epollFd = -1;
+    int _timerFd = -1;
+    int _wakeFd = -1;
+    EdgeSource _edges[MaxEdgeSources];
+    std::size_t _edgeCount = 0;
+#endif
+};
+
+template<typename ClockPolicy>
+class BasicEventQueue : public EventQueueBase
+{
+public:
+    using EventQueueBase::EventQueueBase;
+    using EventQueueBase::PlanEvent;
+    using EventQueueBase::PlanPeriodic;
+    using EventQueueBase::PlanWaveform;
+    using EventQueueBase::Reschedule;
+
+    static Time Now() { return ClockPolicy::Now(); }
+
+    EventHandle PlanEvent(Event event, Duration duration, bool deletePrevious = false)
+    {
+        return PlanEvent(event, Now() + duration, deletePrevious);
+    }
+
+    EventHandle PlanEvent(Event event, Duration duration, Duration slack, bool deletePrevious = false)
+    {
+        return PlanEvent(event, Now() + duration, slack, deletePrevious);
+    }
+
+    EventHandle PlanPeriodic(Event event, Duration first, Duration onTime, Duration offTime, Duration slack = Duration())
+    {
+        return PlanPeriodic(event, Now() + first, onTime, offTime, slack);
+    }
+
+    EventHandle PlanWaveform(Event event, Duration first, const Waveform& wave)
+    {
+        return PlanWaveform(event, Now() + first, wave);
+    }
+
+    bool Reschedule(EventHandle handle, Duration duration)
+    {
+        return Reschedule(handle, Now() + duration);
+    }
+
+    // Same as PlanEvent(event, duration, true), but never blocks and never
+    // allocates: meant for interrupt handlers. The request is queued in a
+    // lock-free ring and merged by whichever thread takes the queue lock next.
+    void PostEvent(Event event, Duration duration)
+    {
+        PostEventAt(event, Now() + duration);
+    }
+
+    Event WaitEvent();
+
+    // Waits like WaitEvent, then stores up to `capacity` due events in the
+    // order WaitEvent would return them. Until the next wait, the returned
+    // events stay cancellable: deleting one turns its slot into ET_Null.
+    std::size_t WaitEvents(Event* events, std::size_t capacity);
+
+private:
+    Entry* WaitDueNotSync(std::unique_lock<std::mutex>& lock);
 };
 
+using EventQueue = BasicEventQueue<SystemClock>;
+
+#ifdef EVENTS_COUNT_ALLOCATIONS
+// Test hook: number of global operator new calls made by the process so far.
+std::uint64_t AllocationCount();
+#endif
 
 #endif//GUARD
\ No newline at end of file
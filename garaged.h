@@ -1,13 +1,22 @@
 #ifndef GUARD_GARAGED_H
 #define GUARD_GARAGED_H
 #include "events.h"
+#include "waveform.h"
+#include "ledclass.h"
+#include "checkpoint.h"
+#include "hal.h"
+#include "outputs.h"
 #include <fstream>
+#include <memory>
+#include <utility>
+#include <initializer_list>
 
 const int PN_Relay = 6;
 const int PN_Button = 30;
 const int PN_Gate = 31;
 const int PN_InternalLed = 21;
 const int PN_ExternalLed = 24;
+const int NoPin = -1;
 
 const Duration ReactDelay = std::chrono::milliseconds(100);
 const Duration BlinkOnTime = std::chrono::milliseconds(500);
@@ -23,47 +32,425 @@ const Duration DisplayTimeLeftBlinkOnTime = std::chrono::milliseconds(70);
 const Duration DisplayTimeLeftBlinkOffTime = std::chrono::milliseconds(250);
 const Duration DisplayTimeLeftPeriod = std::chrono::minutes(5);
 
-class Garaged
+const Duration BlinkSlack = std::chrono::milliseconds(100);
+const Duration LightTimeoutBlinkSlack = std::chrono::milliseconds(50);
+const Duration DisplayTimeLeftSlack = std::chrono::milliseconds(200);
+const Duration DisplayTimeLeftBlinkSlack = std::chrono::milliseconds(20);
+const Duration WriteStatsSlack = std::chrono::minutes(1);
+const Duration ConfigReloadDelay = std::chrono::milliseconds(500);   // lets editors finish writing
+
+const char* const DefaultCheckpointFileName = "/run/garaged.state";
+
+// Allowed dispatch lateness past the deadline, per EventPriority.
+const Duration SafetyLatencyBudget = std::chrono::milliseconds(10);
+const Duration ControlLatencyBudget = std::chrono::milliseconds(50);
+const Duration CosmeticLatencyBudget = std::chrono::milliseconds(100);
+
+const std::size_t QueueCapacity = 128;   // shared by all doors of a host
+const std::size_t DispatchBatchSize = 8;
+
+const int MaxInputs = ET_Input3 - ET_Input0 + 1;
+
+// digitalRead values of an active input.
+const int ActiveLow = 0;
+const int ActiveHigh = 1;
+
+// What pressing an input does to the light; any combination.
+enum InputAction
 {
-protected:
-    Garaged() = default;
+    IA_Toggle = 1,          // a short press switches it on or off
+    IA_Extend = 2,          // a press longer than buttonContinueTime restarts its timers
+    IA_InstantOn = 4,       // the press itself switches it on; the release then does nothing
+    IA_HaltOnLongPress = 8, // holding for buttonHaltTime reboots
+};
+
+const std::size_t MaxNameLength = 32;   // including the terminating zero
 
+// One input channel: a contact or sensor on `pin`. Its level is read once
+// there has been no edge for `debounce`, by then it has settled.
+struct InputConfig
+{
+    char name[MaxNameLength];   // for the log
+    int pin;            // NoPin if the channel is unused
+    int activeLevel;
+    Duration debounce;
+    int actions;        // InputAction flags
+};
+
+// Pins and timings of one door. The globals above are the defaults. Flat, so
+// that it can be copied and swapped as a whole; see config.h for the file.
+struct GaragedConfig
+{
+    char name[MaxNameLength];   // prefixes the door's log lines unless empty
+    int relayPin;
+    InputConfig inputs[MaxInputs];
+    int internalLedPin;
+    int externalLedPin;
+    char internalLedName[MaxNameLength];    // LED class device to blink instead of internalLedPin, if set
+    Duration blinkOnTime;
+    Duration blinkOffTime;
+    Duration lightFinalOffTimeout;
+    Duration lightTimeoutBlink;
+    Duration lightTooLongTimeout;
+    Duration buttonHaltTime;
+    Duration buttonContinueTime;
+    Duration displayTimeLeftTime;
+    Duration displayTimeLeftBlinkOnTime;
+    Duration displayTimeLeftBlinkOffTime;
+    Duration displayTimeLeftPeriod;
+};
+
+const GaragedConfig DefaultConfig =
+{
+    "",
+    PN_Relay,
+    {
+        { "Button", PN_Button, ActiveLow, ReactDelay, IA_Toggle | IA_Extend | IA_HaltOnLongPress },
+        { "Gate button", PN_Gate, ActiveLow, ReactDelay, IA_Toggle | IA_Extend | IA_InstantOn },
+        { "", NoPin, ActiveLow, ReactDelay, 0 },
+        { "", NoPin, ActiveLow, ReactDelay, 0 },
+    },
+    PN_InternalLed, PN_ExternalLed, "",
+    BlinkOnTime, BlinkOffTime, LightFinalOffTimeout, LightTimeoutBlink,
+    LightTooLongTimeout, ButtonHaltTime, ButtonContinueTime, DisplayTimeLeftTime,
+    DisplayTimeLeftBlinkOnTime, DisplayTimeLeftBlinkOffTime, DisplayTimeLeftPeriod,
+};
+
+enum LightMode
+{
+    LM_Off,
+    LM_On,
+    LM_AlmostOff,
+    LM_Count,
+};
+
+// What a door's light reacts to, once input edges have been decoded.
+enum LightTrigger
+{
+    LT_ShortPress,  // input released within ButtonContinueTime
+    LT_LongPress,   // ... or held longer
+    LT_InstantOn,
+    LT_TooLong,
+    LT_FinalOff,
+    LT_Count,
+};
+
+enum LightAction
+{
+    LA_None = 0,
+    LA_Restart = 1, // light stays on; its timers start over
+    LA_Latch = 2,   // the press already acted; ignore its release
+};
+
+struct LightTransition
+{
+    LightMode from;
+    LightTrigger trigger;
+    LightMode to;
+    int actions;
+};
+
+// Every mode reacts to every trigger; LightTransitionsComplete checks that no
+// entry is missing or out of place.
+constexpr LightTransition LightTransitions[LM_Count][LT_Count] =
+{
+    {
+        { LM_Off,       LT_ShortPress,  LM_On,          LA_None },
+        { LM_Off,       LT_LongPress,   LM_Off,         LA_None },
+        { LM_Off,       LT_InstantOn,   LM_On,          LA_Latch },
+        { LM_Off,       LT_TooLong,     LM_AlmostOff,   LA_None },
+        { LM_Off,       LT_FinalOff,    LM_Off,         LA_None },
+    },
+    {
+        { LM_On,        LT_ShortPress,  LM_Off,         LA_None },
+        { LM_On,        LT_LongPress,   LM_On,          LA_Restart },
+        { LM_On,        LT_InstantOn,   LM_On,          LA_None },
+        { LM_On,        LT_TooLong,     LM_AlmostOff,   LA_None },
+        { LM_On,        LT_FinalOff,    LM_Off,         LA_None },
+    },
+    {
+        { LM_AlmostOff, LT_ShortPress,  LM_On,          LA_None },
+        { LM_AlmostOff, LT_LongPress,   LM_On,          LA_None },
+        { LM_AlmostOff, LT_InstantOn,   LM_AlmostOff,   LA_None },
+        { LM_AlmostOff, LT_TooLong,     LM_AlmostOff,   LA_None },
+        { LM_AlmostOff, LT_FinalOff,    LM_Off,         LA_None },
+    },
+};
+
+constexpr bool LightTransitionsComplete(int mode = 0, int trigger = 0)
+{
+    return mode == LM_Count ||
+           (LightTransitions[mode][trigger].from == mode &&
+            LightTransitions[mode][trigger].trigger == trigger &&
+            LightTransitions[mode][trigger].to < LM_Count &&
+            LightTransitionsComplete(trigger + 1 == LT_Count ? mode + 1 : mode,
+                                     trigger + 1 == LT_Count ? 0 : trigger + 1));
+}
+
+static_assert(LightTransitionsComplete(), "LightTransitions has a missing or misplaced entry");
+
+inline const char* GetLightModeName(LightMode mode)
+{
+    switch (mode)
+    {
+    case LM_Off:        return "Off";
+    case LM_On:         return "On";
+    case LM_AlmostOff:  return "AlmostOff";
+    case LM_Count:      break;
+    }
+    assert(0);
+    return nullptr;
+}
+
+inline const char* GetLightTriggerName(LightTrigger trigger)
+{
+    switch (trigger)
+    {
+    case LT_ShortPress: return "ShortPress";
+    case LT_LongPress:  return "LongPress";
+    case LT_InstantOn:  return "InstantOn";
+    case LT_TooLong:    return "TooLong";
+    case LT_FinalOff:   return "FinalOff";
+    case LT_Count:      break;
+    }
+    assert(0);
+    return nullptr;
+}
+
+template<typename Hal>
+class BasicGaragedHost;
+
+// One door: a light relay with its button, gate contact and LEDs. Any pin but
+// the relay and the button may be NoPin. Runs inside a BasicGaragedHost.
+template<typename Hal>
+class BasicGaraged
+{
 public:
-    enum LightMode
+    using ClockPolicy = typename Hal::ClockPolicy;
+    using Host = BasicGaragedHost<Hal>;
+    using Queue = BasicEventQueue<ClockPolicy>;
+
+    BasicGaraged(Host& host, const GaragedConfig& config, std::uint8_t id)
+        : _host(host), _config(config), _id(id),
+          _internalLed(host.Q(), MakeEvent(ET_Blink)), _externalLed(host.Q(), MakeEvent(ET_BlinkExternal)) {}
+    BasicGaraged(const BasicGaraged&) = delete;
+    BasicGaraged& operator=(const BasicGaraged&) = delete;
+
+    const GaragedConfig& Config() const { return _config; }
+    std::uint8_t Id() const { return _id; }
+
+    Queue& Q() { return _host.Q(); }
+
+    // Events of this door; the id routes them back here.
+    Event MakeEvent(EventType type, std::uint32_t data = 0) const { return Event(type, data, _id); }
+    Event InputEvent(int channel) const { return MakeEvent(EventType(ET_Input0 + channel)); }
+    const Debouncer& InputDebouncer(int channel) const { return _inputs[channel].debouncer; }
+
+    // Writes the event handler table and LightTransitions, one line each.
+    static void DumpTransitions(std::ostream& s);
+
+    // Switches to `config` between two events. Pins, active levels and the
+    // LED name stay as they are until a restart; everything else applies at
+    // once, with pending timers re-timed from when they were started:
+    // LightTooLong from the light going on, LightFinalOff from it going
+    // almost off and Halt from the press. Deadlines already passed fire
+    // straight away. Blink patterns restart with the new times; the next
+    // time-left train uses the new ones.
+    void Reconfigure(const GaragedConfig& config);
+
+private:
+    friend class BasicGaragedHost<Hal>;
+
+    template<typename... T>
+    void Log(const T&... args);
+
+    // Picks up where `resume` left off, if given and sane, before touching
+    // any pin: the relay keeps its level and the pending light timers keep
+    // their deadlines.
+    void Init(const DoorCheckpoint* resume);
+    DoorCheckpoint Checkpoint() const;
+
+    // Dispatch is one lookup in Handlers, indexed by event type; handlers
+    // return false to stop the host.
+    bool HandleEvent(Event evt);
+
+    using Handler = bool (BasicGaraged::*)(Event evt);
+
+    struct EventRoute
+    {
+        EventType type;
+        Handler handler;
+        const char* name;
+    };
+
+    bool OnIgnore(Event evt);
+    bool OnBlink(Event evt);
+    bool OnInput(Event evt);
+    bool OnLightFinalOff(Event evt);
+    bool OnBlinkExternal(Event evt);
+    bool OnLightTooLong(Event evt);
+    bool OnHalt(Event evt);
+
+    static constexpr EventRoute Handlers[ET_Count] =
     {
-        LM_Off,
-        LM_On,
-        LM_AlmostOff,
+        { ET_Null,          &BasicGaraged::OnIgnore,        "OnIgnore" },
+        { ET_Blink,         &BasicGaraged::OnBlink,         "OnBlink" },
+        { ET_Input0,        &BasicGaraged::OnInput,         "OnInput" },
+        { ET_Input1,        &BasicGaraged::OnInput,         "OnInput" },
+        { ET_Input2,        &BasicGaraged::OnInput,         "OnInput" },
+        { ET_Input3,        &BasicGaraged::OnInput,         "OnInput" },
+        { ET_LightFinalOff, &BasicGaraged::OnLightFinalOff, "OnLightFinalOff" },
+        { ET_BlinkExternal, &BasicGaraged::OnBlinkExternal, "OnBlinkExternal" },
+        { ET_LightTooLong,  &BasicGaraged::OnLightTooLong,  "OnLightTooLong" },
+        { ET_Halt,          &BasicGaraged::OnHalt,          "OnHalt" },
+        { ET_WriteStats,    &BasicGaraged::OnIgnore,        "OnIgnore" },
+        { ET_Reload,        &BasicGaraged::OnIgnore,        "OnIgnore" },
     };
 
-    static Garaged& Instance();
+    static constexpr bool HandlersComplete(int type = 0)
+    {
+        return type == ET_Count || (Handlers[type].type == type && HandlersComplete(type + 1));
+    }
+
+    // Runtime state of one input channel, alongside _config.inputs.
+    struct Input
+    {
+        bool pressed = false;
+        bool latched = false;
+        Time pressTime = Time();
+        EventHandle halt;
+        Debouncer debouncer;
+    };
+
+    void OnPress(const InputConfig& config, Input& input, Time time);
+    void OnRelease(const InputConfig& config, Input& input, Time time);
+    const LightTransition& Fire(LightTrigger trigger);
+
+    void WritePin(int pin, int value);
+    void WritePins(std::initializer_list<PinLevel> levels);
+    bool IsPressed(const InputConfig& input);
+
+    void ControlLight(LightMode newMode);
+    void ExtendLight();
+    void DisplayTimeLeft(Duration delay = Duration());
+    bool PlayHeartbeat();
+
+    Host& _host;
+    GaragedConfig _config;
+    const std::uint8_t _id;
+    Input _inputs[MaxInputs];
+    LightMode _lightMode = LM_Off;
+    Time _lightOnTime = Time();
+    Time _almostOffTime = Time();
+    EventHandle _lightTooLong;
+    EventHandle _lightFinalOff;
+    WaveformPlayer<Queue> _internalLed;
+    WaveformPlayer<Queue> _externalLed;
+    KernelLed _kernelLed;
+    Waveform _almostOffWave;
+};
+
+// Runs up to MaxDoors doors from one event queue on one thread. Every event
+// carries the id of its door, so dispatching stays a table lookup however
+// many doors there are, and GPIO edges are routed by pin rather than through
+// a global controller pointer. Parameterised on the HAL (see hal.h), so the
+// same code runs on the board, in the emulator or against VirtualClock, e.g.
+// to simulate a day in a few milliseconds. Definitions are in garaged_impl.h.
+template<typename Hal>
+class BasicGaragedHost
+{
+protected:
+    BasicGaragedHost() = default;
+
+public:
+    using ClockPolicy = typename Hal::ClockPolicy;
+    using Door = BasicGaraged<Hal>;
+    using Queue = BasicEventQueue<ClockPolicy>;
+
+    static const std::size_t MaxDoors = EventQueueBase::MaxTargets;
+    static const int MaxPins = 64;
+
+    using OutputShadow = ShadowOutputs<Hal, MaxPins>;
 
-    EventQueue& Q() { return _q; }
+    static BasicGaragedHost& Instance();
+
+    Queue& Q() { return _q; }
+
+    // The doors' pin writes, flushed after each batch of events.
+    const OutputShadow& Outputs() const { return _outputs; }
+
+    // Must be called before Exec; returns nullptr once MaxDoors are in use.
+    // Exec adds a door with DefaultConfig if none was added.
+    Door* AddDoor(const GaragedConfig& config);
 
     void SetLogFileName(const char* filename);
 
+    // Where internalLedName is looked up; LedClassRoot unless changed.
+    void SetLedClassRoot(const char* root);
+
+    // Exec then creates the doors from this file unless some were added, and
+    // re-reads it on SIGHUP or when it is rewritten.
+    void SetConfigFileName(const char* filename);
+
+    // Exec then resumes the doors from this file and keeps it up to date on
+    // every change of their lights; see CheckpointFile.
+    void SetCheckpointFileName(const char* filename);
+
+    // Re-reads the config file and reconfigures the doors; Exec does it on
+    // ET_Reload. A file that fails to parse is logged and ignored.
+    void Reload();
+
     void Exec();
-    
+
 private:
+    friend class BasicGaraged<Hal>;
+
     template<typename... T>
     void Log(const T&... args);
     void Log2();
     template<typename T1, typename... T>
     void Log2(const T1& arg1, const T&... args);
-    
+
     void Init();
 
-    void ControlLight(LightMode newMode);
+    // Feeds every edge on `pin` to `debouncer`; the first of a burst posts
+    // `event` after the quiet time.
+    bool RoutePin(int pin, Event event, Debouncer& debouncer);
+    void WatchConfig();
+    void SaveCheckpoint();
 
-    EventQueue _q;
-    bool _gatePressed = false;
-    bool _buttonPressed = false;
-    LightMode _lightMode = LM_Off;
-    Time _lightOnTime = Time();
-    Time _buttonPressTime = Time();
-    Time _gatePressTime = Time();
-    bool _gatePressInstantAction = false;
+    // wiringPiISR handlers take no argument, so each pin gets its own.
+    using Isr = void (*)();
+    template<int Pin>
+    static void PinIsr();
+    template<int... Pins>
+    static Isr PinIsrFor(int pin, std::integer_sequence<int, Pins...>);
+
+    void WriteQueueStats();
+    void WriteLatenessStats();
+    void WriteDebounceStats();
+    void WriteOutputStats();
+
+    struct PinRoute
+    {
+        Queue* q;
+        Event event;
+        Debouncer* debouncer;
+    };
+
+    static PinRoute _pinRoutes[MaxPins];
+
+    Queue _q{QueueCapacity};
+    OutputShadow _outputs;
+    std::unique_ptr<Door> _doors[MaxDoors];
+    std::size_t _doorCount = 0;
+    EventQueueBase::Stats _lastStats;
+    Time _lastStatsTime = Time();
     std::ofstream _log;
+    std::string _ledClassRoot = LedClassRoot;
+    std::string _configFileName;
+    std::string _checkpointFileName;
+    CheckpointFile _checkpoint;
 };
 
 #endif
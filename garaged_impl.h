@@ -0,0 +1,811 @@
+#ifndef GUARD_GARAGED_IMPL_H
+#define GUARD_GARAGED_IMPL_H
+#include "garaged.h"
+#include "config.h"
+#include <cerrno>
+#include <set>
+#include <utility>
+#include <cstdlib>
+#include <ctime>
+#include <iomanip>
+#include <cstring>
+
+#ifdef __linux__
+#  include <unistd.h>
+#  include <sys/signalfd.h>
+#  include <sys/inotify.h>
+#  include <poll.h>
+#  include <csignal>
+#  include <thread>
+#endif
+
+// Definitions of BasicGaraged and BasicGaragedHost. Include this in the one
+// source file that instantiates them for its HAL (see hal.h), so that the
+// HAL's functions are inlined into the controller.
+
+inline std::ostream& WriteCurTime(std::ostream& s)
+{
+    time_t now = time(nullptr);
+    tm now_tm;
+#   ifdef _WIN32
+    gmtime_s(&now_tm, &now);
+#   else
+    gmtime_r(&now, &now_tm);
+#   endif
+    s << std::put_time(&now_tm, "[%Y-%m-%d %H:%M:%S UTC]");
+    return s;
+}
+
+// On for onTime, off for offTime, forever.
+inline Waveform SquareWave(Duration onTime, Duration offTime, Duration slack)
+{
+    return Waveform().Then(true, onTime, slack).Then(false, offTime, slack).Repeat(Waveform::Forever);
+}
+
+inline double ToMs(Duration duration)
+{
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+inline void WriteSysInfo(std::ostream& s, const SysInfo* info)
+{
+    if (s.good())
+    {
+        WriteCurTime(s);
+        if (info)
+        {
+            const SysInfo& si = *info;
+            int updays = si.uptime / 86400;
+            int uphours = si.uptime % 86400 / 3600;
+            int upminutes = si.uptime % 3600 / 60;
+            int upsecs = si.uptime % 60;
+            s << " System info:\n" <<
+                "Uptime: " << updays << "d " << uphours << "h " << upminutes << "m " << upsecs << "s\n" <<
+                "Load Avgs: " << si.loads[0] << ":1m " << si.loads[1] << ":5m " << si.loads[2] << ":15m\n" <<
+                "RAM: " << si.totalram << ":tot " << si.freeram << ":fr " << si.sharedram << ":shrd " << si.bufferram << ":buf\n" <<
+                "Processes: " << si.procs << std::endl;
+        }
+        else
+        {
+            s << " Unable to retrieve system info" << std::endl;
+        }
+    }
+}
+
+
+template<typename Hal>
+typename BasicGaragedHost<Hal>::PinRoute BasicGaragedHost<Hal>::_pinRoutes[MaxPins];
+
+template<typename Hal>
+template<typename... T>
+void BasicGaragedHost<Hal>::Log(const T&... args)
+{
+    if (_log.good())
+    {
+        _log << WriteCurTime << ' ';
+        Log2(args...);
+    }
+}
+
+template<typename Hal>
+void BasicGaragedHost<Hal>::Log2()
+{
+    _log << std::endl;
+}
+
+template<typename Hal>
+template<typename T1, typename... T>
+void BasicGaragedHost<Hal>::Log2(const T1& arg1, const T&... args)
+{
+    _log << arg1;
+    Log2(args...);
+}
+
+template<typename Hal>
+BasicGaragedHost<Hal>& BasicGaragedHost<Hal>::Instance()
+{
+    static BasicGaragedHost host;
+    return host;
+}
+
+template<typename Hal>
+typename BasicGaragedHost<Hal>::Door* BasicGaragedHost<Hal>::AddDoor(const GaragedConfig& config)
+{
+    if (_doorCount == MaxDoors)
+        return nullptr;
+    _doors[_doorCount].reset(new Door(*this, config, std::uint8_t(_doorCount)));
+    return _doors[_doorCount++].get();
+}
+
+template<typename Hal>
+void BasicGaragedHost<Hal>::SetLogFileName(const char* filename)
+{
+    _log.open(filename, _log.binary | _log.app | _log.out);
+}
+
+template<typename Hal>
+void BasicGaragedHost<Hal>::SetLedClassRoot(const char* root)
+{
+    _ledClassRoot = root;
+}
+
+template<typename Hal>
+void BasicGaragedHost<Hal>::SetConfigFileName(const char* filename)
+{
+    _configFileName = filename;
+}
+
+template<typename Hal>
+void BasicGaragedHost<Hal>::SetCheckpointFileName(const char* filename)
+{
+    _checkpointFileName = filename;
+}
+
+template<typename Hal>
+void BasicGaragedHost<Hal>::SaveCheckpoint()
+{
+    if (!_checkpoint.IsOpen())
+        return;
+    DoorCheckpoint doors[MaxDoors];
+    for (std::size_t i = 0; i < _doorCount; ++i)
+    {
+        doors[i] = _doors[i]->Checkpoint();
+    }
+    _checkpoint.Save(doors, _doorCount);
+}
+
+template<typename Hal>
+void BasicGaragedHost<Hal>::Reload()
+{
+    HostConfig config;
+    std::string error;
+    if (!LoadConfig(_configFileName.c_str(), config, error))
+    {
+        Log("Config not reloaded: ", error);
+        return;
+    }
+    if (config.doorCount != _doorCount)
+        Log("Adding or removing doors takes a restart");
+    for (std::size_t i = 0; i < _doorCount && i < config.doorCount; ++i)
+    {
+        _doors[i]->Reconfigure(config.doors[i]);
+    }
+    Log("Config reloaded from ", _configFileName);
+}
+
+// A thread that waits for SIGHUP (blocked everywhere else by Exec when there
+// is a config file) and for the config file to be rewritten or replaced, and
+// posts ET_Reload for either. Reloading itself happens on the dispatch thread.
+template<typename Hal>
+void BasicGaragedHost<Hal>::WatchConfig()
+{
+#   ifdef __linux__
+    sigset_t hup;
+    sigemptyset(&hup);
+    sigaddset(&hup, SIGHUP);
+    int signalFd = signalfd(-1, &hup, SFD_CLOEXEC);
+    int inotifyFd = inotify_init1(IN_CLOEXEC);
+    std::string dir = ".";
+    std::string base = _configFileName;
+    std::size_t slash = _configFileName.rfind('/');
+    if (slash != std::string::npos)
+    {
+        dir = _configFileName.substr(0, slash + 1);
+        base = _configFileName.substr(slash + 1);
+    }
+    if (signalFd == -1 || inotifyFd == -1 || inotify_add_watch(inotifyFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) == -1)
+        Log("Unable to watch ", _configFileName, " (", strerror(errno), "), reloading on SIGHUP only");
+
+    std::thread([this, signalFd, inotifyFd, base]
+    {
+        pollfd fds[2] = { { signalFd, POLLIN, 0 }, { inotifyFd, POLLIN, 0 } };
+        alignas(inotify_event) char buffer[4096];
+        while (poll(fds, 2, -1) >= 0)
+        {
+            bool reload = false;
+            if (fds[0].revents & POLLIN)
+            {
+                signalfd_siginfo info;
+                reload = (read(signalFd, &info, sizeof(info)) == sizeof(info));
+            }
+            if (fds[1].revents & POLLIN)
+            {
+                ssize_t len = read(inotifyFd, buffer, sizeof(buffer));
+                for (ssize_t pos = 0; pos < len;)
+                {
+                    const inotify_event* ev = reinterpret_cast<const inotify_event*>(buffer + pos);
+                    if (ev->len && base == ev->name)
+                        reload = true;
+                    pos += sizeof(inotify_event) + ev->len;
+                }
+            }
+            if (reload)
+                Q().PostEvent(ET_Reload, ConfigReloadDelay);
+        }
+    }).detach();
+#   endif
+}
+
+template<typename Hal>
+template<int Pin>
+void BasicGaragedHost<Hal>::PinIsr()
+{
+    const PinRoute& route = _pinRoutes[Pin];
+    if (route.debouncer->Edge(ClockPolicy::Now()))
+        route.q->PostEvent(route.event, route.debouncer->Quiet());
+}
+
+template<typename Hal>
+template<int... Pins>
+typename BasicGaragedHost<Hal>::Isr BasicGaragedHost<Hal>::PinIsrFor(int pin, std::integer_sequence<int, Pins...>)
+{
+    static const Isr isrs[] = { &PinIsr<Pins>... };
+    return isrs[pin];
+}
+
+template<typename Hal>
+bool BasicGaragedHost<Hal>::RoutePin(int pin, Event event, Debouncer& debouncer)
+{
+    if (pin < 0 || pin >= MaxPins)
+        return false;
+    _pinRoutes[pin] = { &_q, event, &debouncer };
+    Hal::OnEdges(pin, PinIsrFor(pin, std::make_integer_sequence<int, MaxPins>()));
+    return true;
+}
+
+template<typename Hal>
+void BasicGaragedHost<Hal>::Init()
+{
+    Log("Starting garaged...");
+    Q().SetLatencyBudget(EP_Safety, SafetyLatencyBudget);
+    Q().SetLatencyBudget(EP_Control, ControlLatencyBudget);
+    Q().SetLatencyBudget(EP_Cosmetic, CosmeticLatencyBudget);
+    DoorCheckpoint resume[MaxDoors];
+    std::size_t resumeCount = 0;
+    if (!_checkpointFileName.empty())
+    {
+        if (!_checkpoint.Open(_checkpointFileName.c_str()))
+            Log("Unable to open checkpoint ", _checkpointFileName, " (", strerror(errno), ")");
+        else if (!_checkpoint.Load(resume, resumeCount))
+            resumeCount = 0;
+    }
+    Log("GPIO: ", Hal::Setup());
+    for (std::size_t i = 0; i < _doorCount; ++i)
+    {
+        _doors[i]->Init(i < resumeCount ? &resume[i] : nullptr);
+    }
+    SaveCheckpoint();
+    Q().PlanPeriodic(ET_WriteStats, Time(), WriteStatsTime, WriteStatsTime, WriteStatsSlack);
+}
+
+template<typename Hal>
+void BasicGaragedHost<Hal>::WriteQueueStats()
+{
+    EventQueueBase::Stats stats = Q().GetStats();
+    Time now = ClockPolicy::Now();
+    if (_lastStatsTime != Time())
+    {
+        double hours = std::chrono::duration<double, std::ratio<3600>>(now - _lastStatsTime).count();
+        std::uint64_t wakeups = stats.wakeups - _lastStats.wakeups;
+        std::uint64_t coalesced = stats.coalesced - _lastStats.coalesced;
+        Log("Wakeups: ", wakeups / hours, "/h, without slack: ", (wakeups + coalesced) / hours, "/h");
+    }
+    Log("Events dispatched: ", stats.dispatched, ", coalesced: ", stats.coalesced, ", dropped: ", stats.dropped);
+    for (int priority = 0; priority < EP_Count; ++priority)
+    {
+        const EventQueueBase::ClassStats& cls = stats.classes[priority];
+        Log(GetPriorityName(EventPriority(priority)), " events: ", cls.dispatched, ", over budget: ", cls.overBudget,
+            ", max lateness: ", ToMs(cls.maxLateness), "ms");
+    }
+#   ifdef EVENTS_COUNT_ALLOCATIONS
+    Log("Allocations: ", AllocationCount());
+#   endif
+    _lastStats = stats;
+    _lastStatsTime = now;
+}
+
+template<typename Hal>
+void BasicGaragedHost<Hal>::WriteLatenessStats()
+{
+    for (int type = ET_Null + 1; type < ET_Count; ++type)
+    {
+        const EventQueueBase::LatenessHistogram& lateness = Q().Lateness(EventType(type));
+        std::uint64_t count = lateness.Count();
+        if (count != 0)
+        {
+            Log("Lateness of ", GetEventName(EventType(type)), " (", count, " events): p50 ", ToMs(lateness.Percentile(0.5)),
+                "ms, p99 ", ToMs(lateness.Percentile(0.99)), "ms, max ", ToMs(lateness.Max()), "ms");
+        }
+    }
+}
+
+template<typename Hal>
+void BasicGaragedHost<Hal>::WriteDebounceStats()
+{
+    for (std::size_t i = 0; i < _doorCount; ++i)
+    {
+        Door& door = *_doors[i];
+        for (int channel = 0; channel < MaxInputs; ++channel)
+        {
+            const Debouncer& debouncer = door._inputs[channel].debouncer;
+            std::uint64_t bursts = debouncer.Bursts();
+            if (bursts != 0)
+            {
+                const Debouncer::DurationHistogram& length = debouncer.BurstLength();
+                door.Log(door._config.inputs[channel].name, ": ", bursts, " bursts of ", debouncer.Edges(), " edges, up to ",
+                         debouncer.MaxBurstEdges(), " in one; bouncing p50 ", ToMs(length.Percentile(0.5)),
+                         "ms, p99 ", ToMs(length.Percentile(0.99)), "ms, max ", ToMs(length.Max()), "ms");
+            }
+        }
+    }
+}
+
+template<typename Hal>
+void BasicGaragedHost<Hal>::WriteOutputStats()
+{
+    Log("Pin writes: ", _outputs.Issued(), " in ", _outputs.Flushes(), " flushes, elided: ", _outputs.Elided());
+}
+
+template<typename Hal>
+void BasicGaragedHost<Hal>::Exec()
+{
+#   ifdef __linux__
+    // Before any thread is started, so that SIGHUP only reaches WatchConfig.
+    // Without a config file nothing reads it and it terminates as usual.
+    if (!_configFileName.empty())
+    {
+        sigset_t hup;
+        sigemptyset(&hup);
+        sigaddset(&hup, SIGHUP);
+        pthread_sigmask(SIG_BLOCK, &hup, nullptr);
+    }
+#   endif
+    if (_doorCount == 0 && !_configFileName.empty())
+    {
+        HostConfig config;
+        std::string error;
+        if (LoadConfig(_configFileName.c_str(), config, error))
+        {
+            for (std::size_t i = 0; i < config.doorCount; ++i)
+                AddDoor(config.doors[i]);
+        }
+        else
+        {
+            Log("Config not loaded: ", error);
+        }
+    }
+    if (_doorCount == 0)
+        AddDoor(DefaultConfig);
+    Init();
+    _outputs.Flush();
+    if (!_configFileName.empty())
+        WatchConfig();
+    Event batch[DispatchBatchSize];
+    for (;;)
+    {
+        std::size_t count = Q().WaitEvents(batch, DispatchBatchSize);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            Event evt = batch[i];
+            if (evt.Type() == ET_WriteStats)
+            {
+                SysInfo info;
+                WriteSysInfo(_log, Hal::ReadSysInfo(info) ? &info : nullptr);
+                WriteQueueStats();
+                WriteLatenessStats();
+                WriteDebounceStats();
+                WriteOutputStats();
+            }
+            else if (evt.Type() == ET_Reload)
+            {
+                Reload();
+            }
+            else if (!_doors[evt.Target()]->HandleEvent(evt))
+            {
+                _outputs.Flush();
+                return;
+            }
+        }
+        _outputs.Flush();
+    }
+}
+
+template<typename Hal>
+template<typename... T>
+void BasicGaraged<Hal>::Log(const T&... args)
+{
+    if (_config.name[0])
+        _host.Log('[', _config.name, "] ", args...);
+    else
+        _host.Log(args...);
+}
+
+template<typename Hal>
+void BasicGaraged<Hal>::WritePin(int pin, int value)
+{
+    _host._outputs.Write(pin, value);
+}
+
+template<typename Hal>
+void BasicGaraged<Hal>::WritePins(std::initializer_list<PinLevel> levels)
+{
+    for (const PinLevel& level : levels)
+        _host._outputs.Write(level.pin, level.value);
+}
+
+template<typename Hal>
+bool BasicGaraged<Hal>::IsPressed(const InputConfig& input)
+{
+    return (Hal::Read(input.pin) == input.activeLevel);
+}
+
+template<typename Hal>
+void BasicGaraged<Hal>::Init(const DoorCheckpoint* resume)
+{
+    Time now = ClockPolicy::Now();
+    if (resume && resume->lightMode != LM_Off && resume->lightMode < LM_Count &&
+        Time(Duration(resume->lightOnTime)) <= now && Time(Duration(resume->almostOffTime)) <= now)
+    {
+        _lightMode = LightMode(resume->lightMode);
+        _lightOnTime = Time(Duration(resume->lightOnTime));
+        _almostOffTime = Time(Duration(resume->almostOffTime));
+    }
+    for (int pin : { _config.relayPin, _config.internalLedPin, _config.externalLedPin })
+    {
+        if (pin != NoPin)
+            _host._outputs.Init(pin, (pin == _config.relayPin && _lightMode != LM_Off) ? PinHigh : PinLow);
+    }
+    for (int i = 0; i < MaxInputs; ++i)
+    {
+        const InputConfig& input = _config.inputs[i];
+        if (input.pin == NoPin)
+            continue;
+        Hal::SetInput(input.pin);
+        _inputs[i].debouncer.SetQuiet(input.debounce);
+#       ifdef EVENTS_EPOLL
+        EventQueueBase::EdgeFormat format;
+        int fd = Hal::OpenEdges(input.pin, format);
+        if (fd != -1 && Q().WatchEdges(fd, InputEvent(i), _inputs[i].debouncer, format))
+            continue;
+#       endif
+        _host.RoutePin(input.pin, InputEvent(i), _inputs[i].debouncer);
+    }
+
+    _almostOffWave = SquareWave(_config.lightTimeoutBlink, _config.lightTimeoutBlink, LightTimeoutBlinkSlack);
+    if (_config.internalLedName[0])
+        _kernelLed.Open(_host._ledClassRoot + '/' + _config.internalLedName);
+    bool offloaded = PlayHeartbeat();
+    if (_config.internalLedName[0])
+    {
+        if (offloaded)
+            Log("Heartbeat offloaded to LED ", _config.internalLedName);
+        else
+            Log("Unable to drive LED ", _config.internalLedName, ", blinking pin ", _config.internalLedPin);
+    }
+    if (_lightMode == LM_On)
+    {
+        _lightTooLong = Q().PlanEvent(MakeEvent(ET_LightTooLong), Time(Duration(resume->lightTooLongAt)));
+        DisplayTimeLeft();
+    }
+    else if (_lightMode == LM_AlmostOff)
+    {
+        _lightFinalOff = Q().PlanEvent(MakeEvent(ET_LightFinalOff), Time(Duration(resume->lightFinalOffAt)));
+        _externalLed.Play(_almostOffWave);
+    }
+    if (_lightMode != LM_Off)
+        Log("Resumed with light ", GetLightModeName(_lightMode));
+    for (int i = 0; i < MaxInputs; ++i)
+    {
+        if (_config.inputs[i].pin != NoPin)
+            Q().PlanEvent(InputEvent(i));
+    }
+}
+
+// Deadlines of the pending light timers are stored as they stand, so that a
+// resumed door keeps them even if the config changed meanwhile.
+template<typename Hal>
+DoorCheckpoint BasicGaraged<Hal>::Checkpoint() const
+{
+    DoorCheckpoint checkpoint = {};
+    checkpoint.lightMode = _lightMode;
+    checkpoint.lightOnTime = _lightOnTime.time_since_epoch().count();
+    checkpoint.almostOffTime = _almostOffTime.time_since_epoch().count();
+    if (_lightMode == LM_On)
+        checkpoint.lightTooLongAt = (_lightOnTime + _config.lightTooLongTimeout).time_since_epoch().count();
+    if (_lightMode == LM_AlmostOff)
+        checkpoint.lightFinalOffAt = (_almostOffTime + _config.lightFinalOffTimeout).time_since_epoch().count();
+    return checkpoint;
+}
+
+// Returns true if the kernel took it.
+template<typename Hal>
+bool BasicGaraged<Hal>::PlayHeartbeat()
+{
+    Waveform heartbeat = SquareWave(_config.blinkOnTime, _config.blinkOffTime, BlinkSlack);
+    if (_kernelLed.Play(heartbeat))
+    {
+        _internalLed.Stop();
+        return true;
+    }
+    if (_config.internalLedPin != NoPin)
+        _internalLed.Play(heartbeat);
+    return false;
+}
+
+template<typename Hal>
+void BasicGaraged<Hal>::Reconfigure(const GaragedConfig& config)
+{
+    GaragedConfig old = _config;
+    _config = config;
+    bool pinsChanged = (_config.relayPin != old.relayPin ||
+                        _config.internalLedPin != old.internalLedPin ||
+                        _config.externalLedPin != old.externalLedPin ||
+                        strcmp(_config.internalLedName, old.internalLedName) != 0);
+    _config.relayPin = old.relayPin;
+    _config.internalLedPin = old.internalLedPin;
+    _config.externalLedPin = old.externalLedPin;
+    memcpy(_config.internalLedName, old.internalLedName, sizeof(_config.internalLedName));
+    for (int i = 0; i < MaxInputs; ++i)
+    {
+        InputConfig& input = _config.inputs[i];
+        const InputConfig& oldInput = old.inputs[i];
+        pinsChanged |= (input.pin != oldInput.pin || input.activeLevel != oldInput.activeLevel);
+        input.pin = oldInput.pin;
+        input.activeLevel = oldInput.activeLevel;
+        _inputs[i].debouncer.SetQuiet(input.debounce);
+        if (_inputs[i].pressed)
+            Q().Reschedule(_inputs[i].halt, _inputs[i].pressTime + _config.buttonHaltTime);
+    }
+    if (pinsChanged)
+        Log("Pin changes take effect after a restart");
+
+    if (_lightMode == LM_On)
+        Q().Reschedule(_lightTooLong, _lightOnTime + _config.lightTooLongTimeout);
+    if (_lightMode == LM_AlmostOff)
+        Q().Reschedule(_lightFinalOff, _almostOffTime + _config.lightFinalOffTimeout);
+
+    if (_config.blinkOnTime != old.blinkOnTime || _config.blinkOffTime != old.blinkOffTime)
+        PlayHeartbeat();
+    if (_config.lightTimeoutBlink != old.lightTimeoutBlink)
+    {
+        _almostOffWave = SquareWave(_config.lightTimeoutBlink, _config.lightTimeoutBlink, LightTimeoutBlinkSlack);
+        if (_lightMode == LM_AlmostOff)
+            _externalLed.Play(_almostOffWave);
+    }
+    _host.SaveCheckpoint();
+}
+
+template<typename Hal>
+void BasicGaraged<Hal>::ControlLight(LightMode newMode)
+{
+    if (newMode != _lightMode)
+    {
+        _externalLed.Stop();
+        if (_lightMode == LM_AlmostOff)
+        {
+            Q().Cancel(_lightFinalOff);
+        }
+
+        if (_lightMode == LM_Off || newMode == LM_Off)
+        {
+            Log("Control Light: ", (newMode != LM_Off) ? "On" : "Off");
+            WritePins({ { _config.externalLedPin, PinLow }, { _config.relayPin, (newMode != LM_Off) ? PinHigh : PinLow } });
+        }
+        else
+        {
+            WritePin(_config.externalLedPin, PinLow);
+        }
+        _lightMode = newMode;
+
+        if (newMode == LM_On)
+        {
+            _lightOnTime = ClockPolicy::Now();
+            _lightTooLong = Q().PlanEvent(MakeEvent(ET_LightTooLong), _config.lightTooLongTimeout);
+            DisplayTimeLeft(_config.displayTimeLeftTime);
+        }
+        else
+        {
+            Q().Cancel(_lightTooLong);
+
+            if (newMode == LM_AlmostOff)
+            {
+                _almostOffTime = ClockPolicy::Now();
+                _lightFinalOff = Q().PlanEvent(MakeEvent(ET_LightFinalOff), _config.lightFinalOffTimeout);
+                _externalLed.Play(_almostOffWave, _config.lightTimeoutBlink);
+            }
+        }
+        _host.SaveCheckpoint();
+    }
+}
+
+template<typename Hal>
+void BasicGaraged<Hal>::ExtendLight()
+{
+    WritePin(_config.externalLedPin, PinLow);
+    _lightOnTime = ClockPolicy::Now();
+    if (!Q().Reschedule(_lightTooLong, _config.lightTooLongTimeout))
+    {
+        Q().Cancel(_lightTooLong);
+        _lightTooLong = Q().PlanEvent(MakeEvent(ET_LightTooLong), _config.lightTooLongTimeout);
+    }
+    DisplayTimeLeft(_config.displayTimeLeftTime);
+    _host.SaveCheckpoint();
+}
+
+// After `delay`, blinks the external LED once plus once per
+// displayTimeLeftPeriod the light has been on, then keeps it dark for
+// displayTimeLeftTime. The whole train is one waveform; its end tick starts
+// the next one.
+template<typename Hal>
+void BasicGaraged<Hal>::DisplayTimeLeft(Duration delay)
+{
+    Duration lightOnDuration = ClockPolicy::Now() + delay - _lightOnTime;
+    auto ticks = lightOnDuration / _config.displayTimeLeftPeriod;
+    if (ticks >= Waveform::Forever)
+        ticks = Waveform::Forever - 1;
+    _externalLed.Play(Waveform()
+        .Then(true, _config.displayTimeLeftBlinkOnTime, DisplayTimeLeftBlinkSlack)
+        .Then(false, _config.displayTimeLeftBlinkOffTime, DisplayTimeLeftBlinkSlack)
+        .Repeat(std::uint16_t(ticks))
+        .Then(true, _config.displayTimeLeftBlinkOnTime, DisplayTimeLeftBlinkSlack)
+        .Then(false, _config.displayTimeLeftTime, DisplayTimeLeftSlack), delay);
+}
+
+template<typename Hal>
+constexpr typename BasicGaraged<Hal>::EventRoute BasicGaraged<Hal>::Handlers[ET_Count];
+
+template<typename Hal>
+void BasicGaraged<Hal>::DumpTransitions(std::ostream& s)
+{
+    for (const EventRoute& route : Handlers)
+    {
+        s << "event " << GetEventName(route.type) << " -> " << route.name << '\n';
+    }
+    for (const auto& row : LightTransitions)
+    {
+        for (const LightTransition& t : row)
+        {
+            s << "light " << GetLightModeName(t.from) << ' ' << GetLightTriggerName(t.trigger)
+              << " -> " << GetLightModeName(t.to)
+              << ((t.actions & LA_Restart) ? " restart" : "")
+              << ((t.actions & LA_Latch) ? " latch" : "") << '\n';
+        }
+    }
+}
+
+template<typename Hal>
+bool BasicGaraged<Hal>::HandleEvent(Event evt)
+{
+    static_assert(HandlersComplete(), "Handlers has a missing or misplaced entry");
+    return (this->*Handlers[evt.Type()].handler)(evt);
+}
+
+template<typename Hal>
+const LightTransition& BasicGaraged<Hal>::Fire(LightTrigger trigger)
+{
+    const LightTransition& t = LightTransitions[_lightMode][trigger];
+    if (t.actions & LA_Restart)
+        ExtendLight();
+    else
+        ControlLight(t.to);
+    return t;
+}
+
+template<typename Hal>
+bool BasicGaraged<Hal>::OnIgnore(Event)
+{
+    return true;
+}
+
+template<typename Hal>
+bool BasicGaraged<Hal>::OnBlink(Event evt)
+{
+    bool blink = ((evt.Data() & WaveLevel) != 0);
+    WritePin(_config.internalLedPin, blink ? PinHigh : PinLow);
+    return true;
+}
+
+// Every input channel goes through here, once per burst of edges after it
+// has gone quiet; what a press does is in its InputConfig::actions. Presses
+// and releases are timed from the first edge of their burst.
+template<typename Hal>
+bool BasicGaraged<Hal>::OnInput(Event evt)
+{
+    int channel = evt.Type() - ET_Input0;
+    const InputConfig& config = _config.inputs[channel];
+    Input& input = _inputs[channel];
+    Time again;
+    if (!input.debouncer.Settle(ClockPolicy::Now(), again))
+    {
+        Q().PlanEvent(evt, again, true);
+        return true;
+    }
+    int level = input.debouncer.SettledLevel();
+    bool pressed = (level >= 0) ? (level == config.activeLevel) : IsPressed(config);
+    if (pressed != input.pressed)
+    {
+        input.pressed = pressed;
+        if (pressed)
+            OnPress(config, input, input.debouncer.SettledTime());
+        else
+            OnRelease(config, input, input.debouncer.SettledTime());
+    }
+    return true;
+}
+
+template<typename Hal>
+void BasicGaraged<Hal>::OnPress(const InputConfig& config, Input& input, Time time)
+{
+    Log(config.name, " pressed");
+    input.pressTime = time;
+    input.latched = false;
+    if (config.actions & IA_HaltOnLongPress)
+        input.halt = Q().PlanEvent(MakeEvent(ET_Halt), time + _config.buttonHaltTime);
+    if (config.actions & IA_InstantOn)
+        input.latched = (Fire(LT_InstantOn).actions & LA_Latch) != 0;
+}
+
+template<typename Hal>
+void BasicGaraged<Hal>::OnRelease(const InputConfig& config, Input& input, Time time)
+{
+    Log(config.name, " released");
+    Q().Cancel(input.halt);
+    if (input.latched)
+        return;
+    Duration dur = time - input.pressTime;
+    if (dur > _config.buttonContinueTime)
+    {
+        if (config.actions & IA_Extend)
+            Fire(LT_LongPress);
+    }
+    else if (config.actions & IA_Toggle)
+    {
+        Fire(LT_ShortPress);
+    }
+}
+
+template<typename Hal>
+bool BasicGaraged<Hal>::OnLightFinalOff(Event)
+{
+    Log("Light timed out");
+    Fire(LT_FinalOff);
+    return true;
+}
+
+template<typename Hal>
+bool BasicGaraged<Hal>::OnBlinkExternal(Event evt)
+{
+    if (evt.Data() & WaveEnd)
+    {
+        if (_lightMode == LM_On)
+            DisplayTimeLeft();
+    }
+    else
+    {
+        bool blink = ((evt.Data() & WaveLevel) != 0);
+        WritePin(_config.externalLedPin, blink ? PinHigh : PinLow);
+    }
+    return true;
+}
+
+template<typename Hal>
+bool BasicGaraged<Hal>::OnLightTooLong(Event)
+{
+    Log("Light almost off");
+    Fire(LT_TooLong);
+    return true;
+}
+
+template<typename Hal>
+bool BasicGaraged<Hal>::OnHalt(Event)
+{
+    Log("Initiating reboot");
+    WritePins({ { _config.relayPin, PinLow }, { _config.externalLedPin, PinHigh }, { _config.internalLedPin, PinHigh } });
+    _kernelLed.Set(true);
+    _host._outputs.Flush();
+    int ret = Hal::Reboot();
+    Log("Reboot returned ", ret, ". Goodbye.");
+    return false;
+}
+
+#endif//GUARD
@@ -0,0 +1,93 @@
+#ifndef GUARD_HAL_H
+#define GUARD_HAL_H
+#include "events.h"
+
+// Everything BasicGaraged needs from the board comes from one HAL type given
+// as a template argument, so backends are swapped at compile time and fully
+// inlined, and several can be linked into one binary. A HAL is a type with:
+//
+//   using ClockPolicy = ...;       // SystemClock or VirtualClock
+//   static const char* Setup();   // once, before anything else; what it drives, for the log
+//   static void SetOutput(int pin, int level);
+//   static void SetInput(int pin); // no pull
+//   static void Write(const PinLevel* levels, std::size_t count);  // together where the hardware can
+//   static int Read(int pin);
+//   static void OnEdges(int pin, void (*isr)());   // isr called on both edges, any thread
+//   static int OpenEdges(int pin, EventQueueBase::EdgeFormat& format); // for EVENTS_EPOLL, -1 if none
+//   static int Reboot();
+//   static bool ReadSysInfo(SysInfo& info);
+//
+// See board.h for the real ones and emu.h for the emulator's.
+
+const int PinLow = 0;
+const int PinHigh = 1;
+
+struct PinLevel
+{
+    int pin;        // NoPin is skipped
+    int value;
+};
+
+struct SysInfo
+{
+    long uptime;                // seconds
+    unsigned long loads[3];
+    unsigned long totalram;
+    unsigned long freeram;
+    unsigned long sharedram;
+    unsigned long bufferram;
+    unsigned short procs;
+};
+
+// Passes everything through to Inner and counts the writes to every pin,
+// calling Observer (if set) with each level written and the time.
+template<typename Inner>
+struct RecordingHal : Inner
+{
+    static const int MaxPins = 64;
+
+    using Observer = void (*)(const PinLevel& level, Time time);
+
+    static void Write(const PinLevel* levels, std::size_t count)
+    {
+        Record(levels, count);
+        Inner::Write(levels, count);
+    }
+
+    static void SetOutput(int pin, int level)
+    {
+        PinLevel write = { pin, level };
+        Record(&write, 1);
+        Inner::SetOutput(pin, level);
+    }
+
+    static void SetObserver(Observer observer) { State().observer = observer; }
+    static std::uint64_t Writes(int pin) { return State().writes[pin]; }
+
+private:
+    struct Recorded
+    {
+        std::uint64_t writes[MaxPins] = {};
+        Observer observer = nullptr;
+    };
+
+    static void Record(const PinLevel* levels, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            if (levels[i].pin < 0 || levels[i].pin >= MaxPins)
+                continue;
+            ++State().writes[levels[i].pin];
+            if (State().observer)
+                State().observer(levels[i], Inner::ClockPolicy::Now());
+        }
+    }
+
+    static Recorded& State()
+    {
+        static Recorded recorded;
+        return recorded;
+    }
+};
+
+#endif//GUARD
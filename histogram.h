@@ -0,0 +1,81 @@
+#ifndef GUARD_HISTOGRAM_H
+#define GUARD_HISTOGRAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+
+// Log-scale histogram of durations: bucket 0 counts everything under 1 us
+// (negative ones included), bucket i > 0 counts [2^(i-1), 2^i) us and the
+// last bucket everything above. Recording is a few relaxed atomic operations
+// and never allocates, so it can stay on in production and be read from any
+// thread while another one records. Calls to Record must be serialised.
+template<typename Duration>
+class LogHistogram
+{
+public:
+    static const int Buckets = 32;
+
+    void Record(Duration value)
+    {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(value).count();
+        int bucket = 0;
+        if (us > 0)
+        {
+            bucket = 64 - __builtin_clzll(std::uint64_t(us));
+            if (bucket >= Buckets)
+                bucket = Buckets - 1;
+        }
+        _counts[bucket].fetch_add(1, std::memory_order_relaxed);
+        if (value.count() > _max.load(std::memory_order_relaxed))
+            _max.store(value.count(), std::memory_order_relaxed);
+    }
+
+    std::uint64_t Count() const
+    {
+        std::uint64_t total = 0;
+        for (const auto& count : _counts)
+            total += count.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    // Upper bound of the bucket holding the given quantile (0..1), capped by
+    // the maximum, so the result is accurate to within a factor of two.
+    Duration Percentile(double quantile) const
+    {
+        std::uint64_t counts[Buckets];
+        std::uint64_t total = 0;
+        for (int i = 0; i < Buckets; ++i)
+        {
+            counts[i] = _counts[i].load(std::memory_order_relaxed);
+            total += counts[i];
+        }
+        if (total == 0)
+            return Duration();
+        std::uint64_t rank = std::uint64_t(quantile * double(total - 1)) + 1;
+        std::uint64_t seen = 0;
+        int bucket = 0;
+        for (; bucket < Buckets - 1; ++bucket)
+        {
+            seen += counts[bucket];
+            if (seen >= rank)
+                break;
+        }
+        Duration bound = std::chrono::duration_cast<Duration>(std::chrono::microseconds(std::int64_t(1) << bucket));
+        if (bucket == Buckets - 1 || bound > Max())
+            return Max();
+        return bound;
+    }
+
+    Duration Max() const
+    {
+        return Duration(_max.load(std::memory_order_relaxed));
+    }
+
+private:
+    std::atomic<std::uint64_t> _counts[Buckets] = {};
+    std::atomic<typename Duration::rep> _max{0};
+};
+
+#endif//GUARD
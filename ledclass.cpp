@@ -0,0 +1,72 @@
+#include "ledclass.h"
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+static long long ToWholeMs(Duration duration)
+{
+    return chrono::duration_cast<chrono::milliseconds>(duration).count();
+}
+
+bool KernelLed::Open(const string& dir)
+{
+    _dir.clear();
+    ifstream trigger(dir + "/trigger");
+    ifstream maxBrightness(dir + "/max_brightness");
+    if (!trigger || !(maxBrightness >> _maxBrightness))
+        return false;
+    _dir = dir;
+    return true;
+}
+
+bool KernelLed::Set(bool on)
+{
+    return IsOpen() && Write("trigger", "none") && Write("brightness", on ? _maxBrightness : "0");
+}
+
+bool KernelLed::Play(const Waveform& wave)
+{
+    if (!IsOpen() || wave.Count() == 0 || wave.BodySteps() != wave.Count() || wave.Repeats() == 0)
+        return false;
+    string brightness = "0";
+    ifstream previous(_dir + "/brightness");
+    previous >> brightness;
+    if (Trigger(wave))
+        return true;
+    // A trigger may have been half set up; take it down again.
+    Write("trigger", "none");
+    Write("brightness", brightness);
+    return false;
+}
+
+bool KernelLed::Trigger(const Waveform& wave)
+{
+    if (wave.Repeats() == Waveform::Forever && wave.Count() == 2 && wave.At(0).level && !wave.At(1).level)
+    {
+        return Write("trigger", "timer") &&
+               Write("delay_on", to_string(ToWholeMs(wave.At(0).duration))) &&
+               Write("delay_off", to_string(ToWholeMs(wave.At(1).duration)));
+    }
+
+    // The pattern trigger ramps between consecutive entries, so every step
+    // is a pair of entries at the same brightness, the second one taking 0 ms.
+    ostringstream pattern;
+    for (uint16_t step = 0; step < wave.Count(); ++step)
+    {
+        const string& brightness = wave.At(step).level ? _maxBrightness : "0";
+        pattern << brightness << ' ' << ToWholeMs(wave.At(step).duration) << ' ' << brightness << " 0 ";
+    }
+    int repeat = (wave.Repeats() == Waveform::Forever) ? -1 : wave.Repeats();
+    return Write("trigger", "pattern") &&
+           Write("pattern", pattern.str()) &&
+           Write("repeat", to_string(repeat));
+}
+
+bool KernelLed::Write(const char* file, const string& value)
+{
+    ofstream out(_dir + '/' + file);
+    out << value;
+    out.flush();
+    return out.good();
+}
@@ -0,0 +1,38 @@
+#ifndef GUARD_LEDCLASS_H
+#define GUARD_LEDCLASS_H
+#include "waveform.h"
+#include <string>
+
+const char* const LedClassRoot = "/sys/class/leds";
+
+// One LED of the Linux LED class (e.g. normal_led from script.fex), driven
+// through its directory under LedClassRoot. Steady waveforms are handed to
+// the kernel's timer or pattern trigger, so they blink without the daemon
+// waking up at all; it only writes again when the pattern changes. Any
+// directory laid out like the sysfs one will do, e.g. for tests.
+class KernelLed
+{
+public:
+    // Needs trigger and max_brightness in `dir`.
+    bool Open(const std::string& dir);
+    bool IsOpen() const { return !_dir.empty(); }
+
+    // Holds the LED on or off with the trigger removed.
+    bool Set(bool on);
+
+    // Plays a body-only waveform in the kernel: a forever on/off pair through
+    // the timer trigger, anything else through the pattern trigger. Returns
+    // false if there is a tail or the kernel refuses it, leaving the LED
+    // with the trigger removed at the brightness it had before; the waveform
+    // then has to be played by a WaveformPlayer.
+    bool Play(const Waveform& wave);
+
+private:
+    bool Trigger(const Waveform& wave);
+    bool Write(const char* file, const std::string& value);
+
+    std::string _dir;
+    std::string _maxBrightness;
+};
+
+#endif//GUARD
@@ -1,10 +1,26 @@
 #include <unistd.h>
 #include <iostream>
 #include <cstring>
+#include <cstdio>
 #include <cerrno>
-#include "garaged.h"
+#include "board.h"
+#include "garaged_impl.h"
 using namespace std;
 
+template<typename Hal>
+static void Run(const char* configFile, const char* checkpointFile, const GaragedConfig& config)
+{
+    BasicGaragedHost<Hal>& host = BasicGaragedHost<Hal>::Instance();
+    host.SetLogFileName("/var/log/garaged.log");
+    if(*checkpointFile)
+        host.SetCheckpointFileName(checkpointFile);
+    if(configFile)
+        host.SetConfigFileName(configFile);
+    else
+        host.AddDoor(config);
+    host.Exec();
+}
+
 int main(int argc, char** argv)
 {
     if(geteuid() != 0)
@@ -13,6 +29,10 @@ int main(int argc, char** argv)
         return 1;
     }
     bool startDaemon = false;
+    bool mapRegisters = false;
+    const char* configFile = nullptr;
+    const char* checkpointFile = DefaultCheckpointFileName;
+    GaragedConfig config = DefaultConfig;
     
     for(int i = 1; i < argc; ++i)
     {
@@ -20,6 +40,26 @@ int main(int argc, char** argv)
         {
             startDaemon = true;
         }
+        else if(strcmp(argv[i], "-l") == 0 && i + 1 < argc)
+        {
+            // Heartbeat on a kernel LED, e.g. normal_led (PA17 in script.fex);
+            // with -c this is internal_led_name in the file instead.
+            snprintf(config.internalLedName, sizeof(config.internalLedName), "%s", argv[++i]);
+        }
+        else if(strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+        {
+            configFile = argv[++i];
+        }
+        else if(strcmp(argv[i], "-m") == 0)
+        {
+            // Pin writes and reads straight to the H3 PIO registers.
+            mapRegisters = true;
+        }
+        else if(strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+        {
+            // State to resume from after a restart; "" disables it.
+            checkpointFile = argv[++i];
+        }
         else
         {
             cerr << "Unknown option: <" << argv[i] << ">" << endl;
@@ -36,8 +76,9 @@ int main(int argc, char** argv)
             return errsv;
         }
     }            
-    Garaged& garaged = Garaged::Instance();
-    garaged.SetLogFileName("/var/log/garaged.log");
-    garaged.Exec();
+    if(mapRegisters)
+        Run<PioHal>(configFile, checkpointFile, config);
+    else
+        Run<WiringPiHal>(configFile, checkpointFile, config);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,88 @@
+#ifndef GUARD_OUTPUTS_H
+#define GUARD_OUTPUTS_H
+#include "hal.h"
+#include <cstdint>
+#include <cstddef>
+
+// Output pins behind a shadow copy of their levels. Write only updates the
+// shadow; Flush then hands the pins whose level differs from what was last
+// written to Hal::Write in one call and drops the rest, so writing a pin the
+// level it already has, or several times between flushes, costs no GPIO
+// access. Every dropped write counts as elided. The dispatch thread only.
+template<typename Hal, int MaxPins>
+class ShadowOutputs
+{
+public:
+    // Makes `pin` an output at `level` at once; the shadow starts from there.
+    void Init(int pin, int level)
+    {
+        Hal::SetOutput(pin, level);
+        if (pin < 0 || pin >= MaxPins)
+            return;
+        _pins[pin].level = _pins[pin].written = level;
+        _pins[pin].known = true;
+    }
+
+    // NoPin is ignored.
+    void Write(int pin, int value)
+    {
+        if (pin < 0 || pin >= MaxPins)
+            return;
+        Pin& shadow = _pins[pin];
+        shadow.level = value;
+        if (shadow.pending)
+        {
+            ++_elided;      // overwritten before it was flushed
+            return;
+        }
+        shadow.pending = true;
+        _pending[_pendingCount++] = pin;
+    }
+
+    void Flush()
+    {
+        PinLevel levels[MaxPins];
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < _pendingCount; ++i)
+        {
+            Pin& shadow = _pins[_pending[i]];
+            shadow.pending = false;
+            if (shadow.known && shadow.written == shadow.level)
+            {
+                ++_elided;
+                continue;
+            }
+            levels[count++] = { _pending[i], shadow.level };
+            shadow.written = shadow.level;
+            shadow.known = true;
+        }
+        _pendingCount = 0;
+        if (count == 0)
+            return;
+        Hal::Write(levels, count);
+        _issued += count;
+        ++_flushes;
+    }
+
+    std::uint64_t Issued() const { return _issued; }
+    std::uint64_t Elided() const { return _elided; }
+    std::uint64_t Flushes() const { return _flushes; }     // Hal::Write calls
+
+private:
+    struct Pin
+    {
+        int level = PinLow;     // as last written here
+        int written = PinLow;   // as last passed to the HAL
+        bool known = false;     // whether `written` is, i.e. Init or a flush
+        bool pending = false;   // in _pending
+    };
+
+    Pin _pins[MaxPins];
+    int _pending[MaxPins];
+    std::size_t _pendingCount = 0;
+    std::uint64_t _issued = 0;
+    std::uint64_t _elided = 0;
+    std::uint64_t _flushes = 0;
+};
+
+#endif//GUARD
@@ -0,0 +1,42 @@
+#include "pio.h"
+
+#ifndef _WIN32
+#  include <unistd.h>
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#endif
+
+PioGpio::~PioGpio()
+{
+#   ifndef _WIN32
+    if (_map)
+        munmap(_map, _mapLength);
+#   endif
+}
+
+bool PioGpio::Open(const char* device)
+{
+#   ifndef _WIN32
+    int fd = open(device, O_RDWR | O_SYNC | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    std::size_t page = std::size_t(sysconf(_SC_PAGESIZE));
+    std::size_t offset = PioBase % page;
+    _mapLength = offset + Ports * PortWords * sizeof(std::uint32_t);
+    void* map = mmap(nullptr, _mapLength, PROT_READ | PROT_WRITE, MAP_SHARED, fd, off_t(PioBase - offset));
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+    _map = map;
+    _regs = reinterpret_cast<volatile std::uint32_t*>(static_cast<char*>(map) + offset);
+    return true;
+#   else
+    (void)device;
+    return false;
+#   endif
+}
+
+void PioGpio::Attach(volatile std::uint32_t* registers)
+{
+    _regs = registers;
+}
@@ -0,0 +1,89 @@
+#ifndef GUARD_PIO_H
+#define GUARD_PIO_H
+#include <cstddef>
+#include <cstdint>
+
+// Allwinner H3 PIO data registers, written directly instead of through
+// wiringPi. Pins are Linux GPIO numbers (port * 32 + index, PA0 = 0) of the
+// main PIO block, ports A to G; the PL port of R_PIO is not covered. Pin
+// modes and pulls are left to wiringPi, only the per-toggle accesses come
+// here. Writes are read-modify-write on the port's data register, so other
+// users of the same port (e.g. a kernel LED trigger) may lose a change made
+// between the read and the write; the bits written here are always right.
+class PioGpio
+{
+public:
+    static const std::uint32_t PioBase = 0x01C20800;
+    static const int Ports = 7;
+    static const std::size_t PortWords = 9;     // CFG0-3, DAT, DRV0-1, PUL0-1
+    static const std::size_t DataWord = 4;
+
+    // Levels to set on several pins at once; one store per port.
+    class Batch
+    {
+    public:
+        void Set(int gpio, int value)
+        {
+            std::uint32_t bit = std::uint32_t(1) << (gpio % 32);
+            _mask[gpio / 32] |= bit;
+            if (value)
+                _values[gpio / 32] |= bit;
+            else
+                _values[gpio / 32] &= ~bit;
+        }
+
+    private:
+        friend class PioGpio;
+        std::uint32_t _mask[Ports] = {};
+        std::uint32_t _values[Ports] = {};
+    };
+
+    PioGpio() = default;
+    PioGpio(const PioGpio&) = delete;
+    PioGpio& operator=(const PioGpio&) = delete;
+    ~PioGpio();
+
+    // Maps the register block through `device`, which maps physical memory
+    // (needs root).
+    bool Open(const char* device = "/dev/mem");
+
+    // Uses `registers`, Ports * PortWords words laid out like the block,
+    // instead; for tests and benchmarks off the board.
+    void Attach(volatile std::uint32_t* registers);
+
+    bool IsOpen() const { return _regs != nullptr; }
+    static bool Covers(int gpio) { return gpio >= 0 && gpio < Ports * 32; }
+
+    int Read(int gpio) const
+    {
+        return (Data(gpio / 32) >> (gpio % 32)) & 1;
+    }
+
+    void Write(int gpio, int value)
+    {
+        std::uint32_t bit = std::uint32_t(1) << (gpio % 32);
+        volatile std::uint32_t& data = Data(gpio / 32);
+        data = value ? (data | bit) : (data & ~bit);
+    }
+
+    void Write(const Batch& batch)
+    {
+        for (int port = 0; port < Ports; ++port)
+        {
+            if (batch._mask[port])
+            {
+                volatile std::uint32_t& data = Data(port);
+                data = (data & ~batch._mask[port]) | batch._values[port];
+            }
+        }
+    }
+
+private:
+    volatile std::uint32_t& Data(int port) const { return _regs[port * PortWords + DataWord]; }
+
+    volatile std::uint32_t* _regs = nullptr;
+    void* _map = nullptr;
+    std::size_t _mapLength = 0;
+};
+
+#endif//GUARD
@@ -0,0 +1,34 @@
+#!/bin/sh
+# Replays days of random presses (sim --random SEED) on the sim built from
+# REV and on the working tree, and diffs the pin writes of each. Meant for
+# changes that must not change behaviour: every seed should print "same".
+# REV needs sim --random.
+#
+#   ./replay.sh REV [SEED...]       # seeds 1 to 8 by default
+set -u
+if [ $# -lt 1 ]; then
+    echo "usage: $0 REV [SEED...]" >&2
+    exit 2
+fi
+rev=$1
+shift
+seeds=${*:-1 2 3 4 5 6 7 8}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+mkdir "$dir/old"
+git archive "$rev" | tar -x -C "$dir/old" || exit 2
+make -C "$dir/old" sim >/dev/null || exit 2
+make sim >/dev/null || exit 2
+status=0
+for seed in $seeds; do
+    "$dir/old/sim" --random "$seed" --trace | grep '^write' > "$dir/old.txt"
+    ./sim --random "$seed" --trace | grep '^write' > "$dir/new.txt"
+    if cmp -s "$dir/old.txt" "$dir/new.txt"; then
+        echo "seed=$seed same writes=$(wc -l < "$dir/new.txt")"
+    else
+        echo "seed=$seed differs"
+        diff "$dir/old.txt" "$dir/new.txt" | head -n 10
+        status=1
+    fi
+done
+exit $status
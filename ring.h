@@ -0,0 +1,84 @@
+#ifndef GUARD_RING_H
+#define GUARD_RING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+
+// Bounded lock-free multi-producer/single-consumer ring. Each cell carries a
+// sequence number telling whether it is free for the producer that claims
+// position pos (seq == pos) or holds a value for the consumer (seq == pos + 1).
+// Push and Pop never block and never allocate; Push fails when the ring is full.
+template<typename T, std::size_t Capacity>
+class MpscRing
+{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    MpscRing()
+    {
+        for (std::size_t i = 0; i < Capacity; ++i)
+            _cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    MpscRing(const MpscRing&) = delete;
+    MpscRing& operator=(const MpscRing&) = delete;
+
+    bool Push(const T& value)
+    {
+        std::size_t pos = _tail.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell& cell = _cells[pos & (Capacity - 1)];
+            std::size_t seq = cell.seq.load(std::memory_order_acquire);
+            std::intptr_t diff = std::intptr_t(seq) - std::intptr_t(pos);
+            if (diff == 0)
+            {
+                if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    cell.value = value;
+                    cell.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = _tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Consumer side: only one thread at a time may call Pop/Empty.
+    bool Pop(T& value)
+    {
+        Cell& cell = _cells[_head & (Capacity - 1)];
+        if (cell.seq.load(std::memory_order_acquire) != _head + 1)
+            return false;
+        value = cell.value;
+        cell.seq.store(_head + Capacity, std::memory_order_release);
+        ++_head;
+        return true;
+    }
+
+    bool Empty() const
+    {
+        return _cells[_head & (Capacity - 1)].seq.load(std::memory_order_acquire) != _head + 1;
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<std::size_t> seq;
+        T value;
+    };
+
+    Cell _cells[Capacity];
+    alignas(64) std::atomic<std::size_t> _tail{0};
+    alignas(64) std::size_t _head = 0;
+};
+
+#endif//GUARD
@@ -0,0 +1,405 @@
+#include "garaged_impl.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace std;
+
+// Headless run of the controller on VirtualClock: replays a day of button and
+// gate presses on two doors through a simulated board (SimHal) and reports
+// how long it took on the wall clock. Every press reaches the controller as
+// edges on its pin's ISR, so through the debouncers; --bounce makes every
+// transition chatter and a few bounce for longer than the debounce time,
+// --random SEED replaces the day's presses with ones made up from SEED, and
+// --edge-timing adds presses that settle well after their first edge. Either
+// way the run fails unless every burst settled exactly once, and with
+// --edge-timing unless those presses were timed from their first edges. With
+// --kernel-led the garage heartbeat goes to a LED class device in a scratch
+// directory standing in for /sys/class/leds. --trace prints every pin write,
+// so that runs of two builds can be diffed, and --dump-transitions prints the
+// door's dispatch and transition tables. --checkpoint FILE keeps the doors'
+// state in FILE; with --crash-at MINUTES the run stops dead at that point of
+// the day and a later run with --resume-at MINUTES carries on from the file.
+
+const int PN_WorkshopRelay = 7;
+const int PN_WorkshopButton = 32;
+const int PN_WorkshopLed = 25;
+
+// The edges of one transition: `edges` of them `gap` apart.
+struct Burst
+{
+    int edges;
+    Duration gap;
+};
+
+const Burst Clean = { 1, Duration() };
+const Burst Chatter = { 5, chrono::milliseconds(3) };     // well within the debounce time
+const Burst Straddle = { 6, chrono::milliseconds(60) };   // outlasts it: settles 400 ms after its first edge
+
+// `press` and `release` shape the edges under --bounce; without it they are
+// clean, except for EdgeTimingPresses.
+struct Press
+{
+    int pin;
+    Duration at;
+    Duration length;
+    Burst press;
+    Burst release;
+};
+
+static const Press Scenario[] =
+{
+    { PN_Button, chrono::hours(7), chrono::milliseconds(300), Chatter, Chatter },
+    { PN_Button, chrono::hours(7) + chrono::minutes(15), chrono::milliseconds(300), Chatter, Chatter },
+    { PN_Gate, chrono::hours(12), chrono::seconds(2), Straddle, Chatter },
+    { PN_Button, chrono::hours(18), chrono::milliseconds(300), Chatter, Chatter },
+    { PN_Button, chrono::hours(18) + chrono::minutes(20), chrono::seconds(2), Straddle, Straddle },
+    { PN_Gate, chrono::hours(18) + chrono::minutes(40), chrono::milliseconds(300), Chatter, Chatter },
+    { PN_WorkshopButton, chrono::hours(9), chrono::milliseconds(300), Chatter, Chatter },
+    { PN_WorkshopButton, chrono::hours(17), chrono::milliseconds(300), Chatter, Chatter },
+};
+
+// Timed from the edges, the first press is short enough to switch the light
+// on, and the second is held long enough to halt; timed from when they
+// settled, neither would be.
+static const Duration ToggleAt = chrono::hours(22);
+static const Duration HaltAt = chrono::hours(22) + chrono::minutes(5);
+
+static const Press EdgeTimingPresses[] =
+{
+    { PN_Button, ToggleAt, chrono::milliseconds(1100), Clean, Straddle },
+    { PN_Button, HaltAt, ButtonHaltTime + chrono::milliseconds(200), Straddle, Clean },
+};
+
+static const Duration SimulatedTime = chrono::hours(24);
+
+// Up to 20 hours of presses of random lengths on all three inputs, none long
+// enough to halt and all further apart than the debounce time, so that each
+// transition is a burst of its own. mt19937's output is fixed by the
+// standard, so a seed stands for the same presses with any build; see
+// replay.sh.
+static vector<Press> RandomPresses(unsigned seed)
+{
+    static const int Pins[] = { PN_Button, PN_Button, PN_Gate, PN_WorkshopButton };
+    static const int LengthsMs[] = { 300, 900, 1300, 2000, 5000 };
+    mt19937 rng(seed);
+    vector<Press> presses;
+    for (Duration at = chrono::seconds(5); at < chrono::hours(20);)
+    {
+        int pin = Pins[rng() % 4];
+        Duration length = chrono::milliseconds(LengthsMs[rng() % 5]);
+        presses.push_back({ pin, at, length, Chatter, Chatter });
+        at += length + chrono::milliseconds(1000 + rng() % 3000000);
+    }
+    return presses;
+}
+
+struct SimEdge
+{
+    Duration at;
+    int pin;
+    bool first;     // of its burst
+};
+
+static Time gStart;
+static Time gHighSince[64];
+static Duration gHighTime[64];
+static Time gRelayOnAt;
+static Time gHaltedAt;
+static bool gTrace = false;
+static Duration gCrashAt = Duration::max();
+static vector<Press> gPresses;
+static vector<SimEdge> gEdges;
+static size_t gNextEdge = 0;
+static void (*gIsrs[64])();
+static uint64_t gFiredEdges[64];
+static uint64_t gFiredBursts[64];
+
+// The board: inputs follow gPresses, outputs go nowhere.
+struct SimHal
+{
+    using ClockPolicy = VirtualClock;
+
+    static const char* Setup() { return "simulation"; }
+    static void SetOutput(int, int) {}
+    static void SetInput(int) {}
+    static void Write(const PinLevel*, std::size_t) {}
+
+    static int Read(int pin)
+    {
+        Duration now = VirtualClock::Now() - gStart;
+        for (const Press& press : gPresses)
+        {
+            if (press.pin == pin && now >= press.at && now < press.at + press.length)
+                return PinLow;
+        }
+        return PinHigh;
+    }
+
+    static void OnEdges(int pin, void (*isr)()) { gIsrs[pin] = isr; }
+#   ifdef EVENTS_EPOLL
+    static int OpenEdges(int, EventQueueBase::EdgeFormat&) { return -1; }
+#   endif
+
+    static int Reboot()
+    {
+        gHaltedAt = VirtualClock::Now();
+        return 0;
+    }
+
+    static bool ReadSysInfo(SysInfo& info)
+    {
+        info = {};
+        return true;
+    }
+};
+
+using SimBoard = RecordingHal<SimHal>;
+using SimHost = BasicGaragedHost<SimBoard>;
+
+static void OnWrite(const PinLevel& level, Time time)
+{
+    if (gTrace)
+        cout << "write " << chrono::duration_cast<chrono::milliseconds>(time - gStart).count()
+             << ' ' << level.pin << ' ' << level.value << '\n';
+    if (level.value == PinHigh && gHighSince[level.pin] == Time())
+    {
+        gHighSince[level.pin] = time;
+        if (level.pin == PN_Relay)
+            gRelayOnAt = time;
+    }
+    else if (level.value == PinLow && gHighSince[level.pin] != Time())
+    {
+        gHighTime[level.pin] += time - gHighSince[level.pin];
+        gHighSince[level.pin] = Time();
+    }
+}
+
+static void AddEdges(int pin, Duration at, const Burst& burst)
+{
+    for (int i = 0; i < burst.edges; ++i)
+        gEdges.push_back({ at + i * burst.gap, pin, i == 0 });
+}
+
+// Calls the ISRs of the edges due by now, as the GPIO interrupts would, and
+// plans the ET_Null tick that brings the next ones.
+static void FireEdges()
+{
+    Duration now = VirtualClock::Now() - gStart;
+    for (; gNextEdge < gEdges.size() && gEdges[gNextEdge].at <= now; ++gNextEdge)
+    {
+        const SimEdge& edge = gEdges[gNextEdge];
+        ++gFiredEdges[edge.pin];
+        if (edge.first)
+            ++gFiredBursts[edge.pin];
+        if (gIsrs[edge.pin])
+            gIsrs[edge.pin]();
+    }
+    if (gNextEdge < gEdges.size())
+        SimHost::Instance().Q().PostEvent(Event(ET_Null), gEdges[gNextEdge].at - now);
+}
+
+void Z_EventNotify(EventAction action, const EventQueueBase::Entry* entry)
+{
+    if (VirtualClock::Now() - gStart >= gCrashAt)
+    {
+        cout << "crashed_at_minutes=" << chrono::duration_cast<chrono::minutes>(gCrashAt).count()
+             << " relay_on_minutes=" << chrono::duration<double, ratio<60>>(gHighTime[PN_Relay]).count() << endl;
+        _exit(3);
+    }
+    if (action == EA_Dispatch && entry->event.Type() == ET_Null)
+        FireEdges();
+}
+
+static string ReadFile(const string& path)
+{
+    ifstream in(path);
+    string value;
+    getline(in, value);
+    return value;
+}
+
+// A directory laid out like a sysfs LED class device with no trigger.
+static string MakeFakeLed(const string& root, const char* name)
+{
+    string dir = root + '/' + name;
+    mkdir(dir.c_str(), 0755);
+    ofstream(dir + "/trigger") << "[none] timer pattern\n";
+    ofstream(dir + "/max_brightness") << "255\n";
+    ofstream(dir + "/brightness") << "0\n";
+    return dir;
+}
+
+int main(int argc, char** argv)
+{
+    gStart = Time(chrono::hours(24));
+    VirtualClock::Set(gStart);
+
+    SimBoard::SetObserver(OnWrite);
+    SimHost& host = SimHost::Instance();
+    bool kernelLed = false;
+    bool bounce = false;
+    bool edgeTiming = false;
+    unsigned randomSeed = 0;
+    Duration resumeAt = Duration();
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--kernel-led") == 0)
+        {
+            kernelLed = true;
+        }
+        else if (strcmp(argv[i], "--bounce") == 0)
+        {
+            bounce = true;
+        }
+        else if (strcmp(argv[i], "--edge-timing") == 0)
+        {
+            edgeTiming = true;
+        }
+        else if (strcmp(argv[i], "--random") == 0 && i + 1 < argc)
+        {
+            randomSeed = unsigned(strtoul(argv[++i], nullptr, 10));
+        }
+        else if (strcmp(argv[i], "--trace") == 0)
+        {
+            gTrace = true;
+        }
+        else if (strcmp(argv[i], "--dump-transitions") == 0)
+        {
+            SimHost::Door::DumpTransitions(cout);
+            return 0;
+        }
+        else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc)
+        {
+            host.SetCheckpointFileName(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--crash-at") == 0 && i + 1 < argc)
+        {
+            gCrashAt = chrono::minutes(atoi(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--resume-at") == 0 && i + 1 < argc)
+        {
+            resumeAt = chrono::minutes(atoi(argv[++i]));
+        }
+        else
+        {
+            host.SetLogFileName(argv[i]);
+        }
+    }
+
+    GaragedConfig garageConfig = DefaultConfig;
+    string ledDir;
+    if (kernelLed)
+    {
+        char root[] = "/tmp/garaged-leds.XXXXXX";
+        if (!mkdtemp(root))
+        {
+            cerr << "mkdtemp failed" << endl;
+            return 1;
+        }
+        host.SetLedClassRoot(root);
+        ledDir = MakeFakeLed(root, "normal_led");
+        strcpy(garageConfig.internalLedName, "normal_led");
+    }
+
+    GaragedConfig workshopConfig = DefaultConfig;
+    strcpy(workshopConfig.name, "workshop");
+    workshopConfig.relayPin = PN_WorkshopRelay;
+    workshopConfig.inputs[0].pin = PN_WorkshopButton;
+    workshopConfig.inputs[1].pin = NoPin;
+    workshopConfig.internalLedPin = NoPin;
+    workshopConfig.externalLedPin = PN_WorkshopLed;
+    workshopConfig.lightTooLongTimeout = chrono::hours(10);
+    SimHost::Door* garage = host.AddDoor(garageConfig);
+    SimHost::Door* workshop = host.AddDoor(workshopConfig);
+
+    vector<Press> day(begin(Scenario), end(Scenario));
+    if (randomSeed)
+        day = RandomPresses(randomSeed);
+    for (Press press : day)
+    {
+        if (!bounce)
+            press.press = press.release = Clean;
+        gPresses.push_back(press);
+    }
+    if (edgeTiming)
+        gPresses.insert(gPresses.end(), begin(EdgeTimingPresses), end(EdgeTimingPresses));
+    for (const Press& press : gPresses)
+    {
+        if (press.at < resumeAt)
+            continue;
+        AddEdges(press.pin, press.at, press.press);
+        AddEdges(press.pin, press.at + press.length, press.release);
+    }
+    stable_sort(gEdges.begin(), gEdges.end(), [](const SimEdge& a, const SimEdge& b) { return a.at < b.at; });
+    if (!gEdges.empty())
+        host.Q().PlanEvent(Event(ET_Null), gStart + gEdges[0].at);
+    host.Q().PlanEvent(garage->MakeEvent(ET_Halt), gStart + SimulatedTime);
+
+    VirtualClock::Set(gStart + resumeAt);
+    Time wallStart = Clock::now();
+    host.Exec();
+    double wallMs = chrono::duration<double, milli>(Clock::now() - wallStart).count();
+
+    EventQueueBase::Stats stats = host.Q().GetStats();
+    cout << "simulated_hours=" << chrono::duration<double, ratio<3600>>(VirtualClock::Now() - gStart).count()
+         << " wall_ms=" << wallMs
+         << " dispatched=" << stats.dispatched << " wakeups=" << stats.wakeups
+         << " relay_on_minutes=" << chrono::duration<double, ratio<60>>(gHighTime[PN_Relay]).count()
+         << " workshop_relay_on_minutes=" << chrono::duration<double, ratio<60>>(gHighTime[PN_WorkshopRelay]).count()
+         << " relay_writes=" << SimBoard::Writes(PN_Relay) << " internal_led_writes=" << SimBoard::Writes(PN_InternalLed)
+         << " external_led_writes=" << SimBoard::Writes(PN_ExternalLed)
+         << " pin_writes_issued=" << host.Outputs().Issued() << " pin_writes_elided=" << host.Outputs().Elided()
+         << " pin_flushes=" << host.Outputs().Flushes();
+
+    // Every burst of edges must have settled exactly once.
+    uint64_t bursts = 0;
+    uint64_t edges = 0;
+    bool ok = true;
+    for (SimHost::Door* door : { garage, workshop })
+    {
+        for (int i = 0; i < MaxInputs; ++i)
+        {
+            int pin = door->Config().inputs[i].pin;
+            if (pin == NoPin)
+                continue;
+            const Debouncer& debouncer = door->InputDebouncer(i);
+            bursts += debouncer.Bursts();
+            edges += debouncer.Edges();
+            ok &= (debouncer.Bursts() == gFiredBursts[pin] && debouncer.Edges() == gFiredEdges[pin]);
+        }
+    }
+    cout << " input_bursts=" << bursts << " input_edges=" << edges << " settled_once=" << ok;
+    if (edgeTiming)
+    {
+        // The light goes on as the release settles, the halt comes on time.
+        const Press& toggle = EdgeTimingPresses[0];
+        Duration toggleSettled = toggle.length + (toggle.release.edges - 1) * toggle.release.gap + ReactDelay;
+        Duration toggledAfter = gRelayOnAt - (gStart + ToggleAt);
+        Duration haltedAfter = gHaltedAt - (gStart + HaltAt);
+        bool timed = (toggledAfter == toggleSettled && haltedAfter == ButtonHaltTime);
+        cout << " toggled_on_after_ms=" << ToMs(toggledAfter) << " halted_after_ms=" << ToMs(haltedAfter)
+             << " edge_timed=" << timed;
+        ok &= timed;
+    }
+    if (kernelLed)
+    {
+        cout << " kernel_led_trigger=" << ReadFile(ledDir + "/trigger")
+             << " kernel_led_delay_on=" << ReadFile(ledDir + "/delay_on")
+             << " kernel_led_delay_off=" << ReadFile(ledDir + "/delay_off")
+             << " kernel_led_brightness=" << ReadFile(ledDir + "/brightness");
+        for (const char* file : { "trigger", "max_brightness", "brightness", "delay_on", "delay_off" })
+            remove((ledDir + '/' + file).c_str());
+        rmdir(ledDir.c_str());
+        rmdir(ledDir.substr(0, ledDir.rfind('/')).c_str());
+    }
+    cout << endl;
+    return ok ? 0 : 1;
+}
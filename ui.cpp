@@ -4,7 +4,7 @@
 #undef max
 #endif
 #include "emu.h"
-#include "garaged.h"
+#include "garaged_impl.h"
 #include <random>
 #include <iostream>
 #include <functional>
@@ -65,7 +65,7 @@ signals :
 
 static UiConnection* gUiConnection = nullptr;
 
-void Z_EventNotify(EventAction ea, const EventQueue::Entry* entry)
+void Z_EventNotify(EventAction ea, const EventQueueBase::Entry* entry)
 {
     EventNotification notification;
     notification.action = ea;
@@ -79,21 +79,28 @@ void Z_EventNotify(EventAction ea, const EventQueue::Entry* entry)
     gUiConnection->SendNotification(notification);
 }
 
-int Z_system(const char *) { return 0; }
-void wiringPiSetup() { }
+const char* EmuHal::Setup()
+{
+    return "emulator";
+}
 
-void digitalWrite(int pin, int value)
+void EmuHal::Write(const PinLevel* levels, std::size_t count)
 {
-    assert(
-        pin == PN_Relay ||
-        pin == PN_InternalLed ||
-        pin == PN_ExternalLed
-    );
-    gUiConnection->SendPinControl(pin, value == LOW ? false : true);
-    
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        int pin = levels[i].pin;
+        if (pin == NoPin)
+            continue;
+        assert(
+            pin == PN_Relay ||
+            pin == PN_InternalLed ||
+            pin == PN_ExternalLed
+        );
+        gUiConnection->SendPinControl(pin, levels[i].value == PinLow ? false : true);
+    }
 }
 
-int digitalRead(int pin)
+int EmuHal::Read(int pin)
 {
     assert(
         pin == PN_Button ||
@@ -101,54 +108,58 @@ int digitalRead(int pin)
     );
     if (pin == PN_Button)
     {
-        return Button ? LOW : HIGH;
+        return Button ? PinLow : PinHigh;
     }
     else if (pin == PN_Gate)
     {
-        return Gate ? LOW : HIGH;
+        return Gate ? PinLow : PinHigh;
     }
-    return LOW;
+    return PinLow;
 }
 
-void pinMode(int pin, int mode)
+void EmuHal::SetOutput(int pin, int level)
 {
     assert(
-        pin == PN_Relay       && mode == OUTPUT ||
-        pin == PN_Button      && mode == INPUT  ||
-        pin == PN_Gate        && mode == INPUT  ||
-        pin == PN_InternalLed && mode == OUTPUT ||
-        pin == PN_ExternalLed && mode == OUTPUT
+        pin == PN_Relay ||
+        pin == PN_InternalLed ||
+        pin == PN_ExternalLed
     );
+    PinLevel write = { pin, level };
+    Write(&write, 1);
 }
 
-void pullUpDnControl(int pin, int pudMode)
+void EmuHal::SetInput(int pin)
 {
     assert(
-        pin == PN_Button && pudMode == PUD_OFF ||
-        pin == PN_Gate   && pudMode == PUD_OFF
+        pin == PN_Button ||
+        pin == PN_Gate
     );
 }
 
-void wiringPiISR(int pin, int edgeMode, void (*handler)())
+void EmuHal::OnEdges(int pin, void (*isr)())
 {
     assert(
-        pin == PN_Button && edgeMode == INT_EDGE_BOTH ||
-        pin == PN_Gate && edgeMode == INT_EDGE_BOTH
+        pin == PN_Button ||
+        pin == PN_Gate
     );
     if (pin == PN_Button)
-        ISR_Button = handler;
+        ISR_Button = isr;
     else if (pin == PN_Gate)
-        ISR_Gate = handler;
+        ISR_Gate = isr;
 }
 
-int Z_sysinfo(struct Z_sysinfo* si)
+int EmuHal::Reboot()
 {
-    struct Z_sysinfo result = {};
+    return 0;
+}
+
+bool EmuHal::ReadSysInfo(SysInfo& info)
+{
+    info = {};
 #ifdef _WIN32
-    result.uptime = GetTickCount() / 1000;
+    info.uptime = GetTickCount() / 1000;
 #endif
-    *si = result;
-    return 0;
+    return true;
 }
 
 enum SavedEventMode
@@ -440,9 +451,7 @@ public slots:
         if (notify.action == EA_Wait)
         {
             Snapshot* snap = CloneSnap(notify.currentTime);
-            auto it = std::find_if(snap->savedEvts.begin(), snap->savedEvts.end(), [](auto& evt) { return evt.mode == SEM_Dispatched; });
-            if (it != snap->savedEvts.end())
-                snap->savedEvts.erase(it);
+            snap->savedEvts.erase(std::remove_if(snap->savedEvts.begin(), snap->savedEvts.end(), [](auto& evt) { return evt.mode == SEM_Dispatched; }), snap->savedEvts.end());
         }
         else if (notify.action == EA_New)
         {
@@ -647,8 +656,8 @@ class ZThread : public QThread
 public:
     virtual void run() override
     {
-        Garaged::Instance().SetLogFileName("garaged.log");
-        Garaged::Instance().Exec();
+        GaragedHost::Instance().SetLogFileName("garaged.log");
+        GaragedHost::Instance().Exec();
     }
 };
 
@@ -673,7 +682,7 @@ int main(int argc, char** argv)
 
     mainWnd.show();
     app.exec();
-    Garaged::Instance().Q().PlanEvent(ET_Halt);
+    GaragedHost::Instance().Q().PlanEvent(ET_Halt);
     zThread.wait();
     
     std::cout.rdbuf(oldCoutBuf);
@@ -0,0 +1,120 @@
+#ifndef GUARD_WAVEFORM_H
+#define GUARD_WAVEFORM_H
+#include "events.h"
+
+// Data() bits of the ticks a waveform timer dispatches.
+const std::uint32_t WaveLevel = 1;  // output level for the step starting now
+const std::uint32_t WaveEnd = 2;    // the last step has elapsed; level is low
+
+// A blink pattern compiled once into a fixed list of steps, each holding a
+// level for a duration. The steps added before Repeat form the body, played
+// the given number of times; the ones added after it play once. The whole
+// waveform is then played by EventQueue::PlanWaveform from a single timer
+// entry, which steps through it against the original phase.
+class Waveform
+{
+public:
+    static const std::size_t MaxSteps = 8;
+    static const std::uint16_t Forever = 0xFFFF;
+
+    struct Step
+    {
+        Duration duration;
+        Duration slack;
+        bool level;
+    };
+
+    Waveform& Then(bool level, Duration duration, Duration slack = Duration())
+    {
+        assert(_count < MaxSteps && duration > Duration());
+        _steps[_count++] = { duration, slack, level };
+        return *this;
+    }
+
+    Waveform& Repeat(std::uint16_t times)
+    {
+        assert(_bodySteps == 0);
+        _bodySteps = _count;
+        _repeat = times;
+        return *this;
+    }
+
+    std::uint16_t FirstStep() const { return (_bodySteps != 0 && _repeat == 0) ? _bodySteps : 0; }
+
+    // Moves to the step after `step`; the step after the last one is the end
+    // tick (Count()), after which Advance returns false.
+    bool Advance(std::uint16_t& step, std::uint16_t& pass) const
+    {
+        if (step >= _count)
+            return false;
+        ++step;
+        if (step == _bodySteps && (_repeat == Forever || ++pass < _repeat))
+            step = 0;
+        return true;
+    }
+
+    std::uint16_t Count() const { return _count; }
+    std::uint16_t BodySteps() const { return _bodySteps; }
+    std::uint16_t Repeats() const { return _repeat; }
+
+    // One pass of the body.
+    Duration BodyDuration() const
+    {
+        Duration total = Duration();
+        for (std::uint16_t step = 0; step < _bodySteps; ++step)
+            total += _steps[step].duration;
+        return total;
+    }
+
+    // The end tick counts as a low step with no duration.
+    const Step& At(std::uint16_t step) const
+    {
+        static const Step end = { Duration(), Duration(), false };
+        return step < _count ? _steps[step] : end;
+    }
+
+    std::uint32_t TickData(std::uint16_t step) const
+    {
+        return step < _count ? (_steps[step].level ? WaveLevel : 0) : WaveEnd;
+    }
+
+private:
+    Step _steps[MaxSteps];
+    std::uint16_t _count = 0;
+    std::uint16_t _bodySteps = 0;
+    std::uint16_t _repeat = 0;
+};
+
+// Plays waveforms on one output through `tick` events. Playing a new one
+// pre-empts whatever is playing, including a tick already dispatched in the
+// current batch, so the output never sees a step of the old waveform again.
+template<typename Queue>
+class WaveformPlayer
+{
+public:
+    WaveformPlayer(Queue& q, Event tick) : _q(q), _tick(tick) {}
+    WaveformPlayer(const WaveformPlayer&) = delete;
+    WaveformPlayer& operator=(const WaveformPlayer&) = delete;
+
+    // The waveform is copied; the first step starts after `delay`.
+    void Play(const Waveform& wave, Duration delay = Duration())
+    {
+        _q.Cancel(_handle);
+        _wave = wave;
+        _handle = _q.PlanWaveform(_tick, delay, _wave);
+    }
+
+    void Stop()
+    {
+        _q.Cancel(_handle);
+        _handle = EventHandle();
+    }
+
+private:
+    Queue& _q;
+    Event _tick;
+    Waveform _wave;
+    EventHandle _handle;
+};
+
+#endif//GUARD